@@ -1,20 +1,1149 @@
+#include <FL/Fl.H>
+#include <FL/Fl_Text_Buffer.H>
+#include <FL/Fl_Widget.H>
+#include <FL/Fl_Box.H>
+#include <FL/fl_ask.H>
 #include "UndoManager.h"
 #include "view_fltk.h"
 #include "window_fltk.h"
+#include "change_tracker.h"
+#include "journal.h"
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <stdint.h>
+#include <unistd.h>
+#include <zlib.h>
 
-UndoManager::UndoManager(Fl_Text_Buffer* buffer, void* view, void* window) {
-    this->buffer = buffer;
-    undo_init(buffer, view, window,nullptr,nullptr);
+#define DV(x) // empty for production; replace with printf(...) for debugging
+
+// Most entries are one run of typing or a single paste: one or two spans
+#define UNDO_INLINE_SPANS 2
+
+// History kept in memory before the oldest entries are spilled to disk
+#define UNDO_DEFAULT_BUDGET ((size_t)64 * 1024 * 1024)
+// Uncompressed size of one spilled chunk
+#define UNDO_SPILL_CHUNK (1024 * 1024)
+// Entries at the near end of either list that are never spilled
+#define UNDO_KEEP_RESIDENT 64
+
+struct UndoInfo {
+    char command;      // INS, BS, DEL
+    int start;
+    int end;
+    bool seq;          // sequency flag
+    TextSpan *spans;   // inserted/deleted text, as spans owned by the piece table
+    int n_spans;
+    TextSpan inline_spans[UNDO_INLINE_SPANS]; // spans points here when they fit
+    bool is_group;     // is this entry a group container?
+    UndoInfo **children; // valid if is_group == true
+    int n_children;    // for a spilled stub ('S'): entries it stands for
+    UndoInfo *next_free; // link while on the free list
+};
+
+enum {
+    INS = 0,
+    BS,
+    DEL
+};
+
+struct SpillReader {
+    const char* p;
+    const char* end;
+    bool ok;
+};
+
+static inline bool is_spilled(const UndoInfo* ui)
+{
+    return ui->command == 'S';
+}
+
+// Whether the document holds the text of an edit: what it inserted while
+// it stands, what it deleted once it is undone (sitting in the redo list).
+// Inserted text deleted again later is the deleting entry's to account for.
+static inline bool text_in_document(const UndoInfo* ui, bool undone)
+{
+    return (ui->command == INS) != undone;
+}
+
+// Append/prepend a span, joining it with its neighbour when the bytes are
+// adjacent (consecutive keystrokes land next to each other in the add buffer)
+static void spans_append(std::vector<TextSpan>& v, TextSpan s)
+{
+    if (!v.empty() && v.back().data + v.back().len == s.data)
+        v.back().len += s.len;
+    else
+        v.push_back(s);
+}
+
+static void spans_prepend(std::vector<TextSpan>& v, TextSpan s)
+{
+    if (!v.empty() && s.data + s.len == v.front().data) {
+        v.front().data = s.data;
+        v.front().len += s.len;
+    } else {
+        v.insert(v.begin(), s);
+    }
+}
+
+// True if the spans hold exactly one UTF-8 character. Looks at no more than
+// four bytes, so a huge paste costs nothing here.
+static bool is_single_char(const TextSpan* spans, size_t n)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < n && len <= 4; i++)
+        len += spans[i].len;
+    if (len == 0 || len > 4)
+        return false;
+    unsigned char c = (unsigned char)spans[0].data[0];
+    size_t expect = c < 0x80 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+    return len == expect;
+}
+
+static void scroll_to_cursor(Fl_Text_Buffer*, double) {
+    // no-op stub here; implement as needed for your view
+}
+
+UndoManager::UndoManager(Fl_Text_Buffer* buffer, PieceTable* pieces, EditorView* view, MainWindow* window)
+{
+    text_buffer = buffer;
+    piece_table = pieces;
+    change_tracker = nullptr;
+    journal = nullptr;
+    external = false;
+    editor_view = view;
+    main_window = window;
+    undo_w = nullptr;
+    redo_w = nullptr;
+
+    ui_tmp = new UndoInfo;
+    memset(ui_tmp, 0, sizeof(UndoInfo));
+    ui_tmp->command = INS;
+    free_infos = nullptr;
+    modified_step = 0;
+    prev_keyval = 0;
+    seq_reserve = false;
+    undo_in_progress = false;
+    replay_ui = nullptr;
+    group_depth = 0;
+    txn_command = INS;
+    txn_start = txn_end = 0;
+
+    memory_budget = UNDO_DEFAULT_BUDGET;
+    resident_bytes = 0;
+    spilled_bytes = 0;
+    undo_list_spilled = 0;
+    spill_fd = -1;
+    spill_end = 0;
+    spill_failed = false;
+
+    if (text_buffer)
+        text_buffer->add_modify_callback(buffer_modified_cb, this);
+    clear_all();
+}
+
+UndoManager::~UndoManager()
+{
+    if (text_buffer)
+        text_buffer->remove_modify_callback(buffer_modified_cb, this);
+    if (spill_fd >= 0)
+        close(spill_fd);
+    delete ui_tmp;
+}
+
+int UndoManager::get_current_keyval()
+{
+    if (editor_view) {
+        return editor_view->last_key;
+    }
+    return 0;
+}
+
+void UndoManager::clear_current_keyval()
+{
+    if (editor_view) {
+        editor_view->last_key = 0;
+    }
+}
+
+// Depth of the undo list as the user sees it, counting spilled entries
+int UndoManager::depth() const
+{
+    return (int)(undo_list.size() + undo_list_spilled);
+}
+
+// Helper: push an UndoInfo into either the current group (if any) or the main undo_list
+void UndoManager::push_to_container(UndoInfo* ui)
+{
+    if (group_depth > 0) {
+        group_stack[group_depth - 1].push_back(ui);
+    } else {
+        undo_list.push_back(ui);
+        resident_bytes += info_cost(ui, false);
+    }
+}
+
+// Take a record from the free list or the arena
+UndoInfo* UndoManager::info_new(char command, int start, int end)
+{
+    UndoInfo* ui = free_infos;
+    if (ui)
+        free_infos = ui->next_free;
+    else
+        ui = (UndoInfo*)arena.alloc(sizeof(UndoInfo));
+    ui->command = command;
+    ui->start = start;
+    ui->end = end;
+    ui->seq = false;
+    ui->spans = nullptr;
+    ui->n_spans = 0;
+    ui->is_group = false;
+    ui->children = nullptr;
+    ui->n_children = 0;
+    ui->next_free = nullptr;
+    return ui;
+}
+
+// Store a copy of a span list in ui; only the span array is stored, never the text
+void UndoManager::info_set_spans(UndoInfo* ui, const TextSpan* spans, size_t n)
+{
+    ui->n_spans = (int)n;
+    if (n <= UNDO_INLINE_SPANS)
+        ui->spans = ui->inline_spans;
+    else
+        ui->spans = (TextSpan*)arena.alloc(n * sizeof(TextSpan));
+    if (n)
+        memcpy(ui->spans, spans, n * sizeof(TextSpan));
+}
+
+void UndoManager::buffer_modified_cb(int pos, int nInserted, int nDeleted, int, const char*, void* cbArg)
+{
+    ((UndoManager*)cbArg)->buffer_modified(pos, nInserted, nDeleted);
+}
+
+// Buffer modified callback: records user edits (but not programmatic edits)
+void UndoManager::buffer_modified(int pos, int nInserted, int nDeleted)
+{
+    if (!piece_table || (nInserted == 0 && nDeleted == 0))
+        return;
+
+    // Keep the piece table in step with the display buffer, including the
+    // edits undo/redo make. Fl_Text_Buffer leaves its gap right after
+    // inserted text, so [pos, pos + nInserted) is contiguous here.
+    // Undo entries only keep the spans the piece table reports, so neither
+    // inserted nor deleted text is copied for the history.
+    removed_spans.clear();
+    if (nDeleted > 0)
+        piece_table->remove(pos, nDeleted, undo_in_progress ? nullptr : &removed_spans);
+    TextSpan inserted = { nullptr, 0 };
+    if (nInserted > 0) {
+        if (replay_ui && nInserted == replay_ui->end - replay_ui->start)
+            piece_table->insert_spans(pos, replay_ui->spans, replay_ui->n_spans);
+        else
+            inserted = piece_table->insert(pos, text_buffer->address(pos), nInserted);
+    }
+    if (external)
+        return;
+    if (change_tracker)
+        change_tracker->edited(pos, nInserted, nDeleted);
+    if (journal)
+        journal->record(pos, nInserted ? text_buffer->address(pos) : nullptr, nInserted, nDeleted);
+
+    if (undo_in_progress) {
+        // we are performing undo/redo; ignore modifications triggered by us
+        return;
+    }
+
+    // A replace() reports both at once: keep it as one undoable step
+    bool replace = nInserted > 0 && nDeleted > 0;
+    if (replace)
+        begin_group();
+
+    if (group_depth > 0) {
+        // inside a transaction: record and leave the rest to end_group()
+        if (nDeleted > 0)
+            txn_record(DEL, pos, pos + nDeleted, removed_spans.data(), removed_spans.size());
+        if (nInserted > 0)
+            txn_record(INS, pos, pos + nInserted, &inserted, 1);
+        if (replace)
+            end_group();
+        return;
+    }
+
+    if (nDeleted > 0) {
+        int keyval = get_current_keyval();
+        char command = (keyval == FL_BackSpace) ? BS : DEL;
+        create_undo_info(command, pos, pos + nDeleted, removed_spans.data(), removed_spans.size());
+    }
+    if (nInserted > 0)
+        create_undo_info(INS, pos, pos + nInserted, &inserted, 1);
+    enforce_budget();
+
+    // user edits imply document changed; toggle appropriately in check function
+    check_modified_step();
+}
+
+void UndoManager::set_buffer(Fl_Text_Buffer* buffer, PieceTable* pieces)
+{
+    if (text_buffer)
+        text_buffer->remove_modify_callback(buffer_modified_cb, this);
+    text_buffer = buffer;
+    piece_table = pieces;
+    if (text_buffer)
+        text_buffer->add_modify_callback(buffer_modified_cb, this);
+    clear_all();
+}
+
+void UndoManager::set_buttons(Fl_Widget* undo_button, Fl_Widget* redo_button)
+{
+    undo_w = undo_button;
+    redo_w = redo_button;
+    if (undo_w) {
+        if (depth() > 0) undo_w->activate(); else undo_w->deactivate();
+    }
+    if (redo_w) {
+        if (!redo_list.empty()) redo_w->activate(); else redo_w->deactivate();
+    }
+}
+
+void UndoManager::clear_all()
+{
+    // Drop both lists and any open groups; every record goes with the arena
+    undo_list.clear();
+    redo_list.clear();
+    group_depth = 0;
+    free_infos = nullptr;
+    tmp_spans.clear();
+    txn_spans.clear();
+    arena.reset();
+
+    // and whatever went to disk
+    resident_bytes = 0;
+    spilled_bytes = 0;
+    undo_list_spilled = 0;
+    spill_chunks.clear();
+    if (spill_fd >= 0 && spill_end > 0 && ftruncate(spill_fd, 0) == 0)
+        spill_end = 0;
+    spill_failed = false;
+    enforce_budget();
+
+    // reset internal state
+    reset_modified_step();
+
+    if (undo_w) undo_w->deactivate();
+    if (redo_w) redo_w->deactivate();
+
+    ui_tmp->command = INS;
+    ui_tmp->start = ui_tmp->end = 0;
+    prev_keyval = 0;
+}
+
+void UndoManager::reset_modified_step()
+{
+    flush_temporal_buffer();
+    modified_step = depth();
+    DV(printf("reset_modified_step: Reseted modified_step to %d\n", modified_step));
+}
+
+void UndoManager::check_modified_step()
+{
+    if (!text_buffer) return;
+
+    bool flag = (modified_step == depth());
+    if (main_window) {
+        if (main_window->changed == flag) {
+            main_window->changed = !flag;
+        }
+    }
+}
+
+void UndoManager::set_sequency(bool seq)
+{
+    if (!undo_list.empty())
+        undo_list.back()->seq = seq;
+    DV(printf("<set_sequency: %d>\n", seq));
+}
+
+void UndoManager::set_sequency_reserve()
+{
+    seq_reserve = true;
+}
+
+//
+// Grouped transactions API
+//
+void UndoManager::begin_group()
+{
+    // typing still being merged comes before the group, not inside it
+    if (group_depth == 0)
+        flush_temporal_buffer();
+    else
+        txn_flush();
+
+    // open a child list for the current group, reusing an old one if possible
+    if (group_depth == group_stack.size())
+        group_stack.push_back(std::vector<UndoInfo*>());
+    group_stack[group_depth++].clear();
+    DV(printf("begin_group: depth=%zu\n", group_depth));
+}
+
+void UndoManager::end_group()
+{
+    if (group_depth == 0) {
+        DV(printf("end_group: called without matching begin\n"));
+        return;
+    }
+
+    // flush the run being merged so it becomes part of the group
+    txn_flush();
+
+    // pop the group's child list
+    std::vector<UndoInfo*>& children = group_stack[--group_depth];
+
+    // If group is empty, do nothing
+    if (children.empty())
+        return;
+
+    // A group holding a single edit is just that edit
+    if (children.size() == 1 && !children[0]->is_group) {
+        UndoInfo* only = children[0];
+        children.clear();
+        append_undo_info(only);
+        if (group_depth == 0) {
+            enforce_budget();
+            check_modified_step();
+        }
+        return;
+    }
+
+    // Create a group container UndoInfo with its children copied into the arena
+    UndoInfo* group_ui = info_new('G', 0, 0); // 'G': arbitrary indicator (not INS/BS/DEL)
+    group_ui->is_group = true;
+    group_ui->n_children = (int)children.size();
+    group_ui->children = (UndoInfo**)arena.alloc(children.size() * sizeof(UndoInfo*));
+    memcpy(group_ui->children, children.data(), children.size() * sizeof(UndoInfo*));
+
+    // push into parent group or main undo_list
+    push_to_container(group_ui);
+
+    // when a user makes a new edit after grouping, redo history should be cleared.
+    // Important: only clear redo when we are not currently performing undo/redo.
+    if (!undo_in_progress) {
+        clear_info_list(redo_list);
+        if (redo_w) redo_w->deactivate();
+    }
+
+    if (undo_w) undo_w->activate();
+    DV(printf("end_group: created group with %d children depth=%zu\n", group_ui->n_children, group_depth));
+    if (group_depth == 0) {
+        enforce_budget();
+        check_modified_step();
+    }
+}
+
+// Record an edit made inside a group. Scripted edits tend to come as runs
+// (appending at the end of the last insert, or deleting forward from the
+// same spot); those are merged so that one child covers the whole run.
+void UndoManager::txn_record(char command, int start, int end, const TextSpan* spans, size_t n_spans)
+{
+    if (!txn_spans.empty() && command == txn_command) {
+        if ((command == INS && start == txn_end) || (command != INS && start == txn_start)) {
+            for (size_t i = 0; i < n_spans; i++)
+                spans_append(txn_spans, spans[i]);
+            txn_end += end - start;
+            return;
+        }
+    }
+    txn_flush();
+    txn_command = command;
+    txn_start = start;
+    txn_end = end;
+    txn_spans.assign(spans, spans + n_spans);
+}
+
+void UndoManager::txn_flush()
+{
+    if (txn_spans.empty() || group_depth == 0)
+        return;
+    UndoInfo* ui = info_new(txn_command, txn_start, txn_end);
+    info_set_spans(ui, txn_spans.data(), txn_spans.size());
+    group_stack[group_depth - 1].push_back(ui);
+    txn_spans.clear();
+}
+
+void UndoManager::flush_temporal_buffer()
+{
+    if (tmp_spans.empty()) return;
+
+    // Build a single UndoInfo for the buffered text and place it in the current container (group or undo_list)
+    UndoInfo* ui = info_new(ui_tmp->command, ui_tmp->start, ui_tmp->end);
+    ui->seq = seq_reserve;
+    info_set_spans(ui, tmp_spans.data(), tmp_spans.size());
+
+    seq_reserve = false;
+
+    push_to_container(ui);
+    tmp_spans.clear();
+
+    // clear redo on real user edits (not during undo/redo)
+    if (!undo_in_progress) {
+        clear_info_list(redo_list);
+        if (redo_w) redo_w->deactivate();
+    }
+}
+
+void UndoManager::undo()
+{
+    while (undo_real()) {}
+    enforce_budget();
+}
+
+void UndoManager::redo()
+{
+    while (redo_real()) {}
+    enforce_budget();
+}
+
+// Put the text of ui back at ui->start. Fl_Text_Buffer::insert() wants one
+// NUL-terminated string, so the spans are gathered into a scratch copy that
+// lives only for the call; the piece table takes back the spans themselves.
+// Neither can hold a NUL (a file's are replaced as it is read), so both
+// take all of it.
+void UndoManager::reinsert(const UndoInfo* ui)
+{
+    size_t len = ui->end - ui->start;
+    char* text = (char*)malloc(len + 1);
+    char* p = text;
+    for (int i = 0; i < ui->n_spans; i++) {
+        memcpy(p, ui->spans[i].data, ui->spans[i].len);
+        p += ui->spans[i].len;
+    }
+    *p = '\0';
+
+    replay_ui = ui;
+    text_buffer->insert(ui->start, text);
+    replay_ui = nullptr;
+    free(text);
+}
+
+// Apply action for a single UndoInfo; if ui->is_group, iterate children appropriately
+void UndoManager::apply_action(UndoInfo* ui, bool is_undo)
+{
+    if (!ui) return;
+
+    if (!ui->is_group) {
+        switch (ui->command) {
+        case INS:
+            if (is_undo) {
+                // undo of INSERT is remove
+                text_buffer->remove(ui->start, ui->end);
+            } else {
+                // redo of INSERT is insert
+                reinsert(ui);
+            }
+            break;
+        default:
+            // BS/DEL are both deletions originally; undo (recreate text) => insert, redo => remove
+            if (is_undo) {
+                reinsert(ui);
+            } else {
+                text_buffer->remove(ui->start, ui->end);
+            }
+            break;
+        }
+    } else {
+        // group: either run children in reverse (undo) or forward (redo)
+        if (is_undo) {
+            // reverse order
+            for (int i = ui->n_children; i-- > 0; ) {
+                apply_action(ui->children[i], true);
+            }
+        } else {
+            for (int i = 0; i < ui->n_children; i++) {
+                apply_action(ui->children[i], false);
+            }
+        }
+    }
+}
+
+bool UndoManager::undo_real()
+{
+    flush_temporal_buffer();
+
+    if (!undo_list.empty() && is_spilled(undo_list.back()) && !unspill(undo_list)) {
+        fl_alert("Older undo history could not be read back from disk and has been dropped.");
+        clear_info_list(undo_list);
+    }
+    if (undo_list.empty()) {
+        if (undo_w) undo_w->deactivate();
+        return false;
+    }
+
+    // take last undo entry
+    UndoInfo *ui = undo_list.back();
+    undo_list.pop_back();
+
+    // bracket programmatic edits to avoid generating new undo entries
+    undo_in_progress = true;
+    apply_action(ui, /*is_undo=*/true);
+    undo_in_progress = false;
+
+    // move group/item to redo_list as a single unit
+    redo_list.push_back(ui);
+    resident_bytes += info_cost(ui, true) - info_cost(ui, false);
+
+    DV(printf("undo_real: undo left = %zu, redo left = %zu\n", undo_list.size(), redo_list.size()));
+
+    if (undo_list.empty()) {
+        if (undo_w) undo_w->deactivate();
+    } else {
+        if (undo_list.back()->seq) {
+            // there is more sequential undo entries, continue
+            if (redo_w) redo_w->activate();
+            if (undo_w) undo_w->activate();
+            check_modified_step();
+            return true;
+        }
+    }
+
+    if (redo_w) redo_w->activate();
+    text_buffer->select(ui->start, ui->start);
+    scroll_to_cursor(text_buffer, 0.05);
+
+    check_modified_step();
+    return false;
+}
+
+bool UndoManager::redo_real()
+{
+    if (!redo_list.empty() && is_spilled(redo_list.back()) && !unspill(redo_list)) {
+        fl_alert("Redo history could not be read back from disk and has been dropped.");
+        clear_info_list(redo_list);
+    }
+    if (redo_list.empty()) {
+        if (redo_w) redo_w->deactivate();
+        return false;
+    }
+
+    // take last redo entry
+    UndoInfo *ri = redo_list.back();
+    redo_list.pop_back();
+
+    undo_in_progress = true;
+    apply_action(ri, /*is_undo=*/false);
+    undo_in_progress = false;
+
+    // move the unit back to undo_list
+    undo_list.push_back(ri);
+    resident_bytes += info_cost(ri, false) - info_cost(ri, true);
+
+    DV(printf("redo_real: undo left = %zu, redo left = %zu\n", undo_list.size(), redo_list.size()));
+
+    if (!ri->seq) {
+        // if not a chained sequence, stop here; else the caller will loop again
+    }
+
+    if (redo_list.empty()) {
+        if (redo_w) redo_w->deactivate();
+    }
+    if (undo_w) undo_w->activate();
+
+    text_buffer->select(ri->start, ri->start);
+    scroll_to_cursor(text_buffer, 0.05);
+
+    check_modified_step();
+    return ri->seq;
+}
+
+// Hand UndoInfo records (and their children) back to the free list. This
+// only touches the records; nothing is freed until the arena is reset.
+void UndoManager::release_info(UndoInfo* ui)
+{
+    if (ui->is_group) {
+        for (int i = 0; i < ui->n_children; i++)
+            release_info(ui->children[i]);
+    }
+    ui->next_free = free_infos;
+    free_infos = ui;
+}
+
+void UndoManager::clear_info_list(std::vector<UndoInfo*>& info_list)
+{
+    for (size_t i = 0; i < info_list.size(); i++) {
+        UndoInfo* ui = info_list[i];
+        if (!ui)
+            continue;
+        resident_bytes -= info_cost(ui, &info_list == &redo_list);
+        if (is_spilled(ui)) {
+            // the chunk's space in the file is only reclaimed by clear_all()
+            spilled_bytes -= spill_chunks[ui->start].stored;
+            if (&info_list == &undo_list)
+                undo_list_spilled -= ui->n_children - 1;
+        }
+        release_info(ui);
+    }
+    info_list.clear();
+}
+
+void UndoManager::append_undo_info(UndoInfo* ui)
+{
+    if (!ui) return;
+    push_to_container(ui);
+    seq_reserve = false;
+    // clear redo if this is a new user edit (and not during undo/redo)
+    if (!undo_in_progress) {
+        clear_info_list(redo_list);
+        if (redo_w) redo_w->deactivate();
+    }
+    if (undo_w) undo_w->activate();
+}
+
+// Create a new UndoInfo for a user edit event. This respects grouping (pushes into current group if present).
+// start/end are byte offsets; the text is the span list the piece table reported.
+void UndoManager::create_undo_info(char command, int start, int end, const TextSpan* spans, size_t n_spans)
+{
+    bool seq_flag = false;
+    int keyval = get_current_keyval();
+    bool single_char = is_single_char(spans, n_spans);
+
+    // Attempt to merge into temporal buffer if applicable (simple char-by-char sequence merging)
+    if (!tmp_spans.empty()) {
+        if (single_char && (command == ui_tmp->command)) {
+            switch (keyval) {
+            case FL_BackSpace:
+                if (end == ui_tmp->start)
+                    seq_flag = true;
+                break;
+            case FL_Delete:
+                if (start == ui_tmp->start)
+                    seq_flag = true;
+                break;
+            case FL_Tab:
+            case ' ':
+                if (start == ui_tmp->end)
+                    seq_flag = true;
+                break;
+            default:
+                if (start == ui_tmp->end)
+                    if (keyval && keyval < 0xF000)
+                        switch (prev_keyval) {
+                        case FL_Enter:
+                        case FL_Tab:
+                        case ' ':
+                            break;
+                        default:
+                            seq_flag = true;
+                        }
+            }
+        }
+        if (seq_flag) {
+            switch (command) {
+            case BS:
+                for (size_t i = n_spans; i-- > 0; )
+                    spans_prepend(tmp_spans, spans[i]);
+                ui_tmp->start = start;
+                break;
+            default:
+                for (size_t i = 0; i < n_spans; i++)
+                    spans_append(tmp_spans, spans[i]);
+                ui_tmp->end += end - start;
+            }
+            // editing while typing: clear redo (only when not programmatic)
+            if (!undo_in_progress) {
+                clear_info_list(redo_list);
+                if (redo_w) redo_w->deactivate();
+            }
+            prev_keyval = keyval;
+            if (undo_w) undo_w->activate();
+            return;
+        }
+        // flush previous buffered temporal thing as a real UndoInfo
+        UndoInfo* buffered = info_new(ui_tmp->command, ui_tmp->start, ui_tmp->end);
+        buffered->seq = ui_tmp->seq;
+        info_set_spans(buffered, tmp_spans.data(), tmp_spans.size());
+        append_undo_info(buffered);
+        tmp_spans.clear();
+    }
+
+    if (!keyval && prev_keyval)
+        set_sequency(true);
+
+    if (single_char &&
+        ((keyval && keyval < 0xF000) ||
+         keyval == FL_BackSpace || keyval == FL_Delete || keyval == FL_Tab)) {
+        ui_tmp->command = command;
+        ui_tmp->start = start;
+        ui_tmp->end = end;
+        tmp_spans.assign(spans, spans + n_spans);
+    } else {
+        // allocate a single UndoInfo item and push into container/group
+        UndoInfo* ui = info_new(command, start, end);
+        ui->seq = seq_reserve;
+        info_set_spans(ui, spans, n_spans);
+        append_undo_info(ui);
+    }
+
+    // After making a concrete edit, clear redo (unless undo_in_progress)
+    if (!undo_in_progress) {
+        clear_info_list(redo_list);
+        if (redo_w) redo_w->deactivate();
+    }
+
+    prev_keyval = keyval;
+    clear_current_keyval();
+
+    if (undo_w) undo_w->activate();
+    if (redo_w) redo_w->deactivate();
+}
+
+//
+// History memory budget
+//
+// Once the history in memory outgrows the budget, runs of the oldest
+// entries are serialized, deflated and appended to an unlinked temp file.
+// Each run is replaced in its list by one stub entry (command 'S', start =
+// index into spill_chunks) that is read back when undo or redo reaches it.
+// Entries whose text the document still holds are left where they are,
+// so stubs may sit between resident entries.
+
+// Memory an entry keeps alive, undone if it is in the redo list: the
+// record, its out-of-line arrays and the add-buffer text only the history
+// refers to. Text in the original file mapping or in the document is free.
+size_t UndoManager::info_cost(const UndoInfo* ui, bool undone) const
+{
+    size_t cost = sizeof(UndoInfo);
+    if (ui->is_group) {
+        cost += ui->n_children * sizeof(UndoInfo*);
+        for (int i = 0; i < ui->n_children; i++)
+            cost += info_cost(ui->children[i], undone);
+    } else {
+        if (ui->n_spans > UNDO_INLINE_SPANS)
+            cost += ui->n_spans * sizeof(TextSpan);
+        if (text_in_document(ui, undone))
+            return cost;
+        for (int i = 0; i < ui->n_spans; i++) {
+            if (!piece_table || !piece_table->in_original(ui->spans[i].data))
+                cost += ui->spans[i].len;
+        }
+    }
+    return cost;
+}
+
+// Whether spilling ui would free its text: not if the document holds
+// add-buffer text of it, which reading it back would copy a second time
+bool UndoManager::spillable(const UndoInfo* ui, bool undone) const
+{
+    if (is_spilled(ui))
+        return false;
+    if (ui->is_group) {
+        for (int i = 0; i < ui->n_children; i++) {
+            if (!spillable(ui->children[i], undone))
+                return false;
+        }
+        return true;
+    }
+    if (!text_in_document(ui, undone))
+        return true;
+    for (int i = 0; i < ui->n_spans; i++) {
+        if (!piece_table->in_original(ui->spans[i].data))
+            return false;
+    }
+    return true;
+}
+
+void UndoManager::spill_put(const void* p, size_t len)
+{
+    spill_buf.insert(spill_buf.end(), (const char*)p, (const char*)p + len);
+}
+
+// Serialized entry: command, seq, start, end, count, then the children of a
+// group or the spans of an edit. Spans into the file mapping are stored as
+// an offset, anything else by value.
+void UndoManager::spill_put_info(const UndoInfo* ui)
+{
+    char head[2] = { ui->command, (char)ui->seq };
+    int32_t fields[3] = { ui->start, ui->end, ui->is_group ? ui->n_children : ui->n_spans };
+    spill_put(head, sizeof(head));
+    spill_put(fields, sizeof(fields));
+    if (ui->is_group) {
+        for (int i = 0; i < ui->n_children; i++)
+            spill_put_info(ui->children[i]);
+        return;
+    }
+    for (int i = 0; i < ui->n_spans; i++) {
+        const TextSpan& span = ui->spans[i];
+        bool original = piece_table->in_original(span.data);
+        uint64_t len = span.len;
+        spill_put(&original, 1);
+        spill_put(&len, sizeof(len));
+        if (original) {
+            uint64_t offset = span.data - piece_table->original();
+            spill_put(&offset, sizeof(offset));
+        } else {
+            spill_put(span.data, span.len);
+        }
+    }
+}
+
+static bool spill_get(SpillReader* r, void* out, size_t len)
+{
+    if (!r->ok || (size_t)(r->end - r->p) < len)
+        return r->ok = false;
+    memcpy(out, r->p, len);
+    r->p += len;
+    return true;
+}
+
+UndoInfo* UndoManager::spill_get_info(SpillReader* r)
+{
+    char head[2];
+    int32_t fields[3];
+    if (!spill_get(r, head, sizeof(head)) || !spill_get(r, fields, sizeof(fields)) || fields[2] < 0)
+        return nullptr;
+
+    UndoInfo* ui = info_new(head[0], fields[0], fields[1]);
+    ui->seq = head[1] != 0;
+    if (head[0] == 'G') {
+        ui->is_group = true;
+        ui->n_children = fields[2];
+        ui->children = (UndoInfo**)arena.alloc(fields[2] * sizeof(UndoInfo*));
+        for (int i = 0; i < fields[2]; i++) {
+            ui->children[i] = spill_get_info(r);
+            if (!ui->children[i])
+                return nullptr;
+        }
+        return ui;
+    }
+
+    std::vector<TextSpan> spans;
+    for (int i = 0; i < fields[2]; i++) {
+        char original;
+        uint64_t len, offset;
+        if (!spill_get(r, &original, 1) || !spill_get(r, &len, sizeof(len)))
+            return nullptr;
+        TextSpan span;
+        if (original) {
+            if (!spill_get(r, &offset, sizeof(offset)) || !piece_table->original())
+                return nullptr;
+            span.data = piece_table->original() + offset;
+            span.len = len;
+        } else {
+            if ((size_t)(r->end - r->p) < len)
+                return nullptr;
+            span = piece_table->store(r->p, len);
+            r->p += len;
+        }
+        spans.push_back(span);
+    }
+    info_set_spans(ui, spans.data(), spans.size());
+    return ui;
+}
+
+bool UndoManager::spill_open()
+{
+    if (spill_fd >= 0)
+        return true;
+    const char* dir = getenv("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/leafpad-undo-XXXXXX", dir && *dir ? dir : "/tmp");
+    spill_fd = mkstemp(path);
+    if (spill_fd < 0) {
+        spill_failed = true;
+        return false;
+    }
+    unlink(path);
+    return true;
+}
+
+// Move the oldest run of spillable entries of list into one chunk on disk.
+// Returns false if there is nothing left that may be spilled.
+bool UndoManager::spill(std::vector<UndoInfo*>& list)
+{
+    bool undone = &list == &redo_list;
+    size_t limit = list.size() > UNDO_KEEP_RESIDENT ? list.size() - UNDO_KEEP_RESIDENT : 0;
+    size_t first = 0;
+    while (first < limit && !spillable(list[first], undone))
+        first++;
+    if (first >= limit)
+        return false;
+
+    spill_buf.clear();
+    size_t last = first, cost = 0;
+    while (last < limit && spill_buf.size() < UNDO_SPILL_CHUNK && spillable(list[last], undone)) {
+        spill_put_info(list[last]);
+        cost += info_cost(list[last], undone);
+        last++;
+    }
+
+    uLongf stored = compressBound(spill_buf.size());
+    spill_zbuf.resize(stored);
+    if (compress2(spill_zbuf.data(), &stored, (const Bytef*)spill_buf.data(),
+                  spill_buf.size(), Z_BEST_SPEED) != Z_OK)
+        return false;
+    for (size_t done = 0; done < stored; ) {
+        ssize_t n = pwrite(spill_fd, spill_zbuf.data() + done, stored - done, spill_end + done);
+        if (n <= 0) {
+            spill_failed = true;
+            return false;
+        }
+        done += n;
+    }
+
+    SpillChunk chunk = { spill_end, (size_t)stored, spill_buf.size() };
+    spill_end += stored;
+    spill_chunks.push_back(chunk);
+
+    UndoInfo* stub = info_new('S', (int)(spill_chunks.size() - 1), 0);
+    stub->n_children = (int)(last - first);
+    stub->seq = list[last - 1]->seq;
+    for (size_t i = first; i < last; i++)
+        release_info(list[i]);
+    list[first] = stub;
+    list.erase(list.begin() + first + 1, list.begin() + last);
+
+    resident_bytes = resident_bytes - cost + info_cost(stub, undone);
+    spilled_bytes += stored;
+    if (&list == &undo_list)
+        undo_list_spilled += stub->n_children - 1;
+    DV(printf("spill: %d entries, %zu -> %zu bytes\n", stub->n_children, spill_buf.size(), (size_t)stored));
+    return true;
+}
+
+// Replace the stub at the back of list with the entries it stands for
+bool UndoManager::unspill(std::vector<UndoInfo*>& list)
+{
+    UndoInfo* stub = list.back();
+    const SpillChunk& chunk = spill_chunks[stub->start];
+
+    spill_zbuf.resize(chunk.stored);
+    for (size_t done = 0; done < chunk.stored; ) {
+        ssize_t n = pread(spill_fd, spill_zbuf.data() + done, chunk.stored - done, chunk.offset + done);
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    spill_buf.resize(chunk.size);
+    uLongf size = chunk.size;
+    if (uncompress((Bytef*)spill_buf.data(), &size, spill_zbuf.data(), chunk.stored) != Z_OK
+        || size != chunk.size)
+        return false;
+
+    SpillReader reader = { spill_buf.data(), spill_buf.data() + size, true };
+    std::vector<UndoInfo*> entries;
+    for (int i = 0; i < stub->n_children; i++) {
+        UndoInfo* ui = spill_get_info(&reader);
+        if (!ui)
+            return false;
+        entries.push_back(ui);
+    }
+    // set_sequency() may have marked the stub while it was last
+    entries.back()->seq = stub->seq;
+
+    bool undone = &list == &redo_list;
+    list.pop_back();
+    resident_bytes -= info_cost(stub, undone);
+    spilled_bytes -= chunk.stored;
+    if (&list == &undo_list)
+        undo_list_spilled -= stub->n_children - 1;
+    release_info(stub);
+    for (size_t i = 0; i < entries.size(); i++) {
+        list.push_back(entries[i]);
+        resident_bytes += info_cost(entries[i], undone);
+    }
+    return true;
+}
+
+static void info_collect_spans(const UndoInfo* ui, std::vector<TextSpan>& out)
+{
+    if (ui->is_group) {
+        for (int i = 0; i < ui->n_children; i++)
+            info_collect_spans(ui->children[i], out);
+    } else {
+        out.insert(out.end(), ui->spans, ui->spans + ui->n_spans);
+    }
+}
+
+UndoInfo* UndoManager::info_clone(const UndoInfo* src)
+{
+    UndoInfo* ui = info_new(src->command, src->start, src->end);
+    ui->seq = src->seq;
+    ui->n_children = src->n_children;
+    if (src->is_group) {
+        ui->is_group = true;
+        ui->children = (UndoInfo**)arena.alloc(src->n_children * sizeof(UndoInfo*));
+        for (int i = 0; i < src->n_children; i++)
+            ui->children[i] = info_clone(src->children[i]);
+    } else {
+        info_set_spans(ui, src->spans, src->n_spans);
+    }
+    return ui;
+}
+
+// After a spill: hand back add-buffer blocks only spilled entries used, and
+// if the arena is mostly dead records and arrays, copy the live history into
+// a fresh one.
+void UndoManager::release_memory()
+{
+    std::vector<TextSpan> keep(tmp_spans);
+    for (size_t i = 0; i < undo_list.size(); i++)
+        info_collect_spans(undo_list[i], keep);
+    for (size_t i = 0; i < redo_list.size(); i++)
+        info_collect_spans(redo_list[i], keep);
+    piece_table->release_unused(keep);
+
+    if (arena.bytes_reserved() <= 2 * resident_bytes + UNDO_SPILL_CHUNK)
+        return;
+    Arena old;
+    old.swap(arena);
+    free_infos = nullptr;
+    for (size_t i = 0; i < undo_list.size(); i++)
+        undo_list[i] = info_clone(undo_list[i]);
+    for (size_t i = 0; i < redo_list.size(); i++)
+        redo_list[i] = info_clone(redo_list[i]);
+}
+
+void UndoManager::report_usage()
+{
+    if (!main_window || !main_window->history_status)
+        return;
+    char label[64];
+    if (spilled_bytes)
+        snprintf(label, sizeof(label), "Undo %.1f MB, %.1f MB on disk",
+                 resident_bytes / 1048576.0, spilled_bytes / 1048576.0);
+    else
+        snprintf(label, sizeof(label), "Undo %.1f MB", resident_bytes / 1048576.0);
+    const char* old = main_window->history_status->label();
+    if (!old || strcmp(old, label) != 0)
+        main_window->history_status->copy_label(label);
 }
 
-UndoManager::~UndoManager() {
-    undo_clear_all();
+// Spill the oldest history until it fits in three quarters of the budget, so
+// that a busy session doesn't spill on every keystroke
+void UndoManager::enforce_budget()
+{
+    if (resident_bytes > memory_budget && group_depth == 0 && piece_table
+        && !spill_failed && spill_open()) {
+        bool spilled = false;
+        while (resident_bytes > memory_budget / 4 * 3) {
+            if (!spill(undo_list) && !spill(redo_list))
+                break;
+            spilled = true;
+        }
+        if (spilled)
+            release_memory();
+    }
+    report_usage();
 }
 
-void UndoManager::undo() {
-    undo_undo();
+void UndoManager::set_memory_budget(size_t bytes)
+{
+    memory_budget = bytes;
+    enforce_budget();
 }
 
-void UndoManager::redo() {
-    undo_redo();
+void UndoManager::get_memory_usage(size_t* resident, size_t* on_disk) const
+{
+    if (resident) *resident = resident_bytes;
+    if (on_disk) *on_disk = spilled_bytes;
 }
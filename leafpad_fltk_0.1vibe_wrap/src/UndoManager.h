@@ -2,19 +2,170 @@
 #define UNDO_MANAGER_H
 
 #include <FL/Fl_Text_Buffer.H>
+#include <sys/types.h>
+#include <stddef.h>
+#include <vector>
 
-#include "undo.h"
+#include "arena.h"
+#include "piece_table.h"
 
+class Fl_Widget;
+class ChangeTracker;
+class EditJournal;
+class EditorView;
+class MainWindow;
+struct UndoInfo;
+struct SpillReader;
+
+// Undo/redo history of one document. Each instance records the edits of
+// its own buffer, so any number of documents can live in one process.
+// Entries keep the spans the piece table hands out rather than copies of
+// the text.
 class UndoManager {
 public:
-    UndoManager(Fl_Text_Buffer* buffer, void* view, void* window);
+    UndoManager(Fl_Text_Buffer* buffer, PieceTable* pieces, EditorView* view, MainWindow* window);
     ~UndoManager();
 
     void undo();
     void redo();
+    bool can_undo() const { return !undo_list.empty() || !tmp_spans.empty(); }
+    bool can_redo() const { return !redo_list.empty(); }
+
+    // Move edit recording to another buffer (NULL detaches); clears history.
+    // pieces must hold the same text as buffer and is kept in step with it.
+    void set_buffer(Fl_Text_Buffer* buffer, PieceTable* pieces);
+    // Told of every edit that reaches the piece table, undo and redo
+    // included (NULL for none)
+    void set_change_tracker(ChangeTracker* tracker) { change_tracker = tracker; }
+    // Likewise told of every edit, with its text, for crash recovery
+    void set_journal(EditJournal* edit_journal) { journal = edit_journal; }
+    // Widgets activated/deactivated as undo and redo become (un)available
+    void set_buttons(Fl_Widget* undo_button, Fl_Widget* redo_button);
+
+    void clear_all();
+    void reset_modified_step();
+    void set_sequency(bool seq);
+    void set_sequency_reserve();
+
+    // Grouped transactions: everything between begin and end is undone and
+    // redone as one step. Groups nest. Edits inside a group only mirror into
+    // the piece table and append to the group; redo clearing, the memory
+    // budget and the modified flag are dealt with once, when the outermost
+    // group ends. Bulk edits should be bracketed by a group.
+    void begin_group();
+    void end_group();
+
+    // Edits between these are text read in from the file rather than
+    // typed: mirrored into the piece table, but not undoable, not tracked
+    // and not journaled. Only appends keep the history's positions right.
+    void begin_external() { external = true; }
+    void end_external() { external = false; }
+
+    // Bytes of history kept in memory before older entries go to disk
+    void set_memory_budget(size_t bytes);
+    void get_memory_usage(size_t* resident, size_t* on_disk) const;
 
 private:
-    Fl_Text_Buffer* buffer;
+    struct SpillChunk {
+        off_t offset;
+        size_t stored;     // compressed bytes in the file
+        size_t size;       // serialized bytes
+    };
+
+    Fl_Text_Buffer* text_buffer;
+    PieceTable* piece_table;
+    ChangeTracker* change_tracker;
+    EditJournal* journal;
+    bool external;          // between begin_external() and end_external()
+    EditorView* editor_view;
+    MainWindow* main_window;
+    Fl_Widget* undo_w;
+    Fl_Widget* redo_w;
+
+    std::vector<UndoInfo*> undo_list;
+    std::vector<UndoInfo*> redo_list;
+    std::vector<TextSpan> tmp_spans;   // text of the run being merged into ui_tmp
+    UndoInfo* ui_tmp;
+
+    // Every UndoInfo, span array and child array lives in this arena, so
+    // clearing the history is one reset rather than a free() per record.
+    // Records dropped with the redo history are recycled through free_infos.
+    Arena arena;
+    UndoInfo* free_infos;
+
+    int modified_step;
+    unsigned int prev_keyval;
+    bool seq_reserve;
+    // Set while undo/redo edit the buffer, so those edits aren't recorded
+    bool undo_in_progress;
+    // Entry whose text undo/redo is re-inserting; the piece table gets its
+    // spans back instead of a fresh copy
+    const UndoInfo* replay_ui;
+    // Scratch list for the spans a deletion took out of the piece table
+    std::vector<TextSpan> removed_spans;
+
+    // Open groups. Child vectors are kept between groups, so once warmed up
+    // begin/end don't allocate.
+    std::vector<std::vector<UndoInfo*> > group_stack;
+    size_t group_depth;
+    // Run of adjacent edits inside a group, merged before it becomes a child
+    char txn_command;
+    int txn_start;
+    int txn_end;
+    std::vector<TextSpan> txn_spans;
+
+    // Spilling: see enforce_budget()
+    size_t memory_budget;
+    size_t resident_bytes;      // records plus the add-buffer text they alone hold
+    size_t spilled_bytes;       // compressed bytes of live chunks
+    size_t undo_list_spilled;   // entries of undo_list hidden inside stubs, minus the stubs
+    std::vector<SpillChunk> spill_chunks;
+    int spill_fd;
+    off_t spill_end;
+    bool spill_failed;
+    std::vector<char> spill_buf;
+    std::vector<unsigned char> spill_zbuf;
+
+    static void buffer_modified_cb(int pos, int nInserted, int nDeleted, int nRestyled,
+                                   const char* deletedText, void* cbArg);
+    void buffer_modified(int pos, int nInserted, int nDeleted);
+
+    int get_current_keyval();
+    void clear_current_keyval();
+    int depth() const;
+
+    UndoInfo* info_new(char command, int start, int end);
+    void info_set_spans(UndoInfo* ui, const TextSpan* spans, size_t n);
+    void release_info(UndoInfo* ui);
+    void clear_info_list(std::vector<UndoInfo*>& info_list);
+    void push_to_container(UndoInfo* ui);
+    void append_undo_info(UndoInfo* ui);
+    void create_undo_info(char command, int start, int end, const TextSpan* spans, size_t n_spans);
+    void flush_temporal_buffer();
+    void txn_record(char command, int start, int end, const TextSpan* spans, size_t n_spans);
+    void txn_flush();
+    void check_modified_step();
+
+    bool undo_real();
+    bool redo_real();
+    void reinsert(const UndoInfo* ui);
+    void apply_action(UndoInfo* ui, bool is_undo);
+
+    size_t info_cost(const UndoInfo* ui, bool undone) const;
+    bool spillable(const UndoInfo* ui, bool undone) const;
+    void spill_put(const void* p, size_t len);
+    void spill_put_info(const UndoInfo* ui);
+    UndoInfo* spill_get_info(SpillReader* r);
+    bool spill_open();
+    bool spill(std::vector<UndoInfo*>& list);
+    bool unspill(std::vector<UndoInfo*>& list);
+    UndoInfo* info_clone(const UndoInfo* src);
+    void release_memory();
+    void report_usage();
+    void enforce_budget();
+
+    UndoManager(const UndoManager&);
+    UndoManager& operator=(const UndoManager&);
 };
 
 #endif // UNDO_MANAGER_H
@@ -0,0 +1,88 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#include "arena.h"
+#include <stdlib.h>
+
+#define ARENA_ALIGN sizeof(void*)
+
+struct Arena::Block {
+    Block* next;
+    size_t size;
+    size_t used;
+};
+
+// Block header rounded up so the payload stays aligned
+#define HEADER ((sizeof(Block) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+Arena::Arena(size_t size)
+{
+    head = nullptr;
+    block_size = size;
+    reserved = 0;
+}
+
+Arena::~Arena()
+{
+    while (head) {
+        Block* next = head->next;
+        free(head);
+        head = next;
+    }
+}
+
+void* Arena::alloc(size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if (!head || head->size - head->used < size) {
+        // Oversized requests get a block of their own, slotted in behind the
+        // current one so its free space isn't abandoned
+        size_t payload = size > block_size / 4 ? size : block_size;
+        Block* b = (Block*)malloc(HEADER + payload);
+        if (!b)
+            return nullptr;
+        b->size = payload;
+        b->used = 0;
+        reserved += payload;
+        if (head && payload != block_size) {
+            b->next = head->next;
+            head->next = b;
+            b->used = size;
+            return (char*)b + HEADER;
+        }
+        b->next = head;
+        head = b;
+    }
+
+    void* p = (char*)head + HEADER + head->used;
+    head->used += size;
+    return p;
+}
+
+void Arena::reset()
+{
+    // keep the oldest block, which is the one a fresh history starts in
+    while (head && head->next) {
+        Block* next = head->next;
+        reserved -= head->size;
+        free(head);
+        head = next;
+    }
+    if (head)
+        head->used = 0;
+}
+
+void Arena::swap(Arena& other)
+{
+    Block* h = head;
+    size_t bs = block_size;
+    size_t r = reserved;
+    head = other.head;
+    block_size = other.block_size;
+    reserved = other.reserved;
+    other.head = h;
+    other.block_size = bs;
+    other.reserved = r;
+}
@@ -0,0 +1,39 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for many small objects that die together. Nothing is freed
+// individually; reset() releases everything at once and keeps one block
+// around for reuse.
+class Arena {
+public:
+    explicit Arena(size_t block_size = 64 * 1024);
+    ~Arena();
+
+    // Uninitialized, pointer-aligned storage valid until reset()
+    void* alloc(size_t size);
+    void reset();
+    // Exchange contents with another arena, e.g. to copy live objects out
+    // of this one and then drop it.
+    void swap(Arena& other);
+
+    // Bytes held in blocks, used or not
+    size_t bytes_reserved() const { return reserved; }
+
+private:
+    struct Block;
+
+    Block* head;       // newest block first
+    size_t block_size;
+    size_t reserved;
+
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+};
+
+#endif // ARENA_H
@@ -0,0 +1,372 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+// Headless benchmark for the undo engine: drives an Fl_Text_Buffer with an
+// UndoManager attached, no window or display involved.
+//
+//   leafpad-bench [-n SCALE] [-t TRACE]...
+//
+// Each workload runs in a child process so peak RSS is its own. A trace is
+// a text file with one operation per line:
+//
+//   key CODE POS TEXT   key press CODE inserting TEXT (rest of line) at POS
+//   bs POS              backspace before POS
+//   del POS             delete after POS
+//   paste POS LEN       paste LEN bytes at POS
+//   undo / redo
+
+#include "UndoManager.h"
+#include "piece_table.h"
+#include "view_fltk.h"
+#include <FL/Fl.H>
+#include <FL/Fl_Text_Buffer.H>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+// Count every allocation in the process, including those behind operator
+// new and inside FLTK, by wrapping glibc's allocator
+static unsigned long alloc_count = 0;
+
+#ifdef __GLIBC__
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+
+void* malloc(size_t size)
+{
+    alloc_count++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+    alloc_count++;
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size)
+{
+    alloc_count++;
+    return __libc_realloc(p, size);
+}
+}
+#endif
+
+enum {
+    OP_KEY,
+    OP_BS,
+    OP_DEL,
+    OP_PASTE,
+    OP_UNDO,
+    OP_REDO
+};
+
+struct TraceOp {
+    int op;
+    int key;
+    int pos;
+    int len;
+    std::string text;
+};
+
+struct Bench {
+    Fl_Text_Buffer* buffer;
+    PieceTable* pieces;
+    EditorView* view;
+    UndoManager* undo;
+    std::string paste;
+};
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static long peak_rss_kb()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+static Bench* bench_new(size_t initial)
+{
+    Bench* b = new Bench;
+    b->buffer = new Fl_Text_Buffer();
+    b->pieces = new PieceTable();
+    b->view = new EditorView(0, 0, 100, 100, NULL);
+    if (initial > 0) {
+        std::string text(initial, 'x');
+        for (size_t i = 79; i < initial; i += 80)
+            text[i] = '\n';
+        b->buffer->text(text.c_str());
+        b->pieces->insert(0, text.data(), text.size());
+    }
+    b->undo = new UndoManager(b->buffer, b->pieces, b->view, NULL);
+    return b;
+}
+
+static int clamp_pos(Bench* b, int pos)
+{
+    if (pos < 0) return 0;
+    if (pos > b->buffer->length()) return b->buffer->length();
+    return pos;
+}
+
+static void run_op(Bench* b, const TraceOp& op)
+{
+    int pos = clamp_pos(b, op.pos);
+    switch (op.op) {
+    case OP_KEY:
+        b->view->last_key = op.key;
+        b->buffer->insert(pos, op.text.c_str());
+        break;
+    case OP_BS:
+        if (pos > 0) {
+            b->view->last_key = FL_BackSpace;
+            b->buffer->remove(b->buffer->prev_char(pos), pos);
+        }
+        break;
+    case OP_DEL:
+        if (pos < b->buffer->length()) {
+            b->view->last_key = FL_Delete;
+            b->buffer->remove(pos, b->buffer->next_char(pos));
+        }
+        break;
+    case OP_PASTE:
+        if ((size_t)op.len >= b->paste.size())
+            b->paste.assign(op.len + 1, 'p');
+        b->paste[op.len] = '\0';
+        b->view->last_key = 0;
+        b->buffer->insert(pos, b->paste.c_str());
+        b->paste[op.len] = 'p';
+        break;
+    case OP_UNDO:
+        b->undo->undo();
+        break;
+    case OP_REDO:
+        b->undo->redo();
+        break;
+    }
+}
+
+// Typing session: words and spaces, line breaks, short backspace runs and
+// the odd jump to another place in the document. ASCII only, so that every
+// position the generator picks is a character boundary.
+static void gen_typing(std::vector<TraceOp>& ops, int n, unsigned int seed)
+{
+    static const char letters[] = "etaoinshrdlu";
+    int pos = 0, doc = 0;
+    for (int i = 0; i < n; i++) {
+        TraceOp op;
+        op.len = 0;
+        int r = rand_r(&seed) % 100;
+        if (r < 3 && doc > 0) {
+            pos = rand_r(&seed) % (doc + 1);
+            continue;
+        } else if (r < 10 && pos > 0) {
+            op.op = OP_BS;
+            op.key = FL_BackSpace;
+            op.pos = pos;
+            pos--;
+            doc--;
+        } else {
+            op.op = OP_KEY;
+            op.pos = pos;
+            if (r < 25) {
+                op.key = ' ';
+                op.text = " ";
+            } else if (r < 28) {
+                op.key = FL_Enter;
+                op.text = "\n";
+            } else {
+                op.text = std::string(1, letters[rand_r(&seed) % 12]);
+                op.key = op.text[0];
+            }
+            pos++;
+            doc++;
+        }
+        ops.push_back(op);
+    }
+}
+
+static void gen_paste(std::vector<TraceOp>& ops, int n, unsigned int seed)
+{
+    int doc = 0;
+    for (int i = 0; i < n; i++) {
+        TraceOp op;
+        op.op = OP_PASTE;
+        op.key = 0;
+        op.len = 1024 << (rand_r(&seed) % 8);   // 1 KB .. 128 KB
+        op.pos = doc ? rand_r(&seed) % doc : 0;
+        doc += op.len;
+        ops.push_back(op);
+    }
+}
+
+static bool load_trace(const char* path, std::vector<TraceOp>& ops)
+{
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    char line[4096];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        line[strcspn(line, "\n")] = '\0';
+        if (!line[0] || line[0] == '#')
+            continue;
+        TraceOp op;
+        op.key = op.pos = op.len = 0;
+        int consumed = 0;
+        if (sscanf(line, "key %d %d %n", &op.key, &op.pos, &consumed) == 2 && consumed) {
+            op.op = OP_KEY;
+            op.text = line + consumed;
+        } else if (sscanf(line, "bs %d", &op.pos) == 1) {
+            op.op = OP_BS;
+        } else if (sscanf(line, "del %d", &op.pos) == 1) {
+            op.op = OP_DEL;
+        } else if (sscanf(line, "paste %d %d", &op.pos, &op.len) == 2 && op.len >= 0) {
+            op.op = OP_PASTE;
+        } else if (!strcmp(line, "undo")) {
+            op.op = OP_UNDO;
+        } else if (!strcmp(line, "redo")) {
+            op.op = OP_REDO;
+        } else {
+            fprintf(stderr, "%s:%d: bad trace line\n", path, lineno);
+            fclose(f);
+            return false;
+        }
+        ops.push_back(op);
+    }
+    fclose(f);
+    return true;
+}
+
+static void report(const char* name, long ops, double ns, unsigned long allocs)
+{
+    printf("%-22s %9ld ops %10.1f ns/op %8.2f allocs/op %9.1f MB peak RSS\n",
+           name, ops, ops ? ns / ops : 0.0, ops ? (double)allocs / ops : 0.0,
+           peak_rss_kb() / 1024.0);
+}
+
+static void bench_trace(const char* name, const std::vector<TraceOp>& ops, size_t initial)
+{
+    Bench* b = bench_new(initial);
+    unsigned long a0 = alloc_count;
+    double t0 = now_ns();
+    for (size_t i = 0; i < ops.size(); i++)
+        run_op(b, ops[i]);
+    report(name, (long)ops.size(), now_ns() - t0, alloc_count - a0);
+}
+
+// Build up history from a trace, then undo all of it and redo all of it,
+// rounds times over. Each undo() or redo() call counts as one op.
+static void bench_storm(const char* name, const std::vector<TraceOp>& ops, int rounds)
+{
+    Bench* b = bench_new(0);
+    for (size_t i = 0; i < ops.size(); i++)
+        run_op(b, ops[i]);
+    b->view->last_key = 0;
+
+    long count = 0;
+    unsigned long a0 = alloc_count;
+    double t0 = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        while (b->undo->can_undo()) {
+            b->undo->undo();
+            count++;
+        }
+        while (b->undo->can_redo()) {
+            b->undo->redo();
+            count++;
+        }
+    }
+    report(name, count, now_ns() - t0, alloc_count - a0);
+}
+
+// One grouped replace every few lines of a large document
+static void bench_replace(const char* name, int n)
+{
+    Bench* b = bench_new((size_t)n * 40);
+    b->view->last_key = 0;
+    unsigned long a0 = alloc_count;
+    double t0 = now_ns();
+    b->undo->begin_group();
+    for (int i = 0, pos = 0; i < n; i++, pos += 37)
+        b->buffer->replace(pos, pos + 3, "XY");
+    b->undo->end_group();
+    report(name, n, now_ns() - t0, alloc_count - a0);
+}
+
+// Run one workload in a child so that its peak RSS isn't anyone else's
+template <typename F>
+static void isolated(F run)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        run();
+        fflush(stdout);
+        _exit(0);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0)
+        run();
+}
+
+int main(int argc, char** argv)
+{
+    int scale = 1;
+    std::vector<const char*> traces;
+    int c;
+    while ((c = getopt(argc, argv, "n:t:")) != -1) {
+        switch (c) {
+        case 'n':
+            scale = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 't':
+            traces.push_back(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n SCALE] [-t TRACE]...\n", argv[0]);
+            return 2;
+        }
+    }
+
+    // load traces up front so a bad one fails before anything runs
+    std::vector<std::vector<TraceOp> > recorded(traces.size());
+    for (size_t i = 0; i < traces.size(); i++) {
+        if (!load_trace(traces[i], recorded[i]))
+            return 1;
+    }
+
+    std::vector<TraceOp> typing, paste;
+    gen_typing(typing, 200000 * scale, 1);
+    gen_paste(paste, 200 * scale, 2);
+
+    isolated([&] { bench_trace("typing", typing, 0); });
+    isolated([&] { bench_trace("typing into 8 MB", typing, 8u << 20); });
+    isolated([&] { bench_trace("paste", paste, 0); });
+    isolated([&] { bench_storm("undo/redo storm", typing, 3); });
+    isolated([&] { bench_replace("grouped replace", 100000 * scale); });
+
+    for (size_t i = 0; i < traces.size(); i++) {
+        const char* name = strrchr(traces[i], '/') ? strrchr(traces[i], '/') + 1 : traces[i];
+        isolated([&] { bench_trace(name, recorded[i], 0); });
+    }
+    return 0;
+}
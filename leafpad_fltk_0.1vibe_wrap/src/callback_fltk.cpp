@@ -3,14 +3,44 @@
  */
 
 #include "callback_fltk.h"
+#include "file_fltk.h"
+#include "search_fltk.h"
+#include "piece_table.h"
+#include "change_tracker.h"
+#include "journal.h"
+#include "watch_fltk.h"
+#include "highlight_fltk.h"
 #include <FL/fl_ask.H>
 #include <FL/Fl_File_Chooser.H>
+#include <FL/Fl_Box.H>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// current_filename is owned by the window; fl_file_chooser() returns a
+// static buffer that the next dialog overwrites.
+static void set_current_filename(MainWindow* window, const char* filename) {
+    free(window->current_filename);
+    window->current_filename = filename ? strdup(filename) : NULL;
+    window->status_bar->copy_label(filename);
+}
 
 void on_file_new(Fl_Widget* w, void* v) {
     MainWindow* window = (MainWindow*)v;
+    file_open_cancel(window);
+    window->highlighter->clear();
+    window->undo_manager->set_buffer(NULL, NULL);
     window->editor->buffer()->text("");
-    window->current_filename = NULL;
+    window->pieces->clear();
+    window->undo_manager->set_buffer(window->editor->buffer(), window->pieces);
+    set_current_filename(window, NULL);
+    window->charset = "UTF-8";
+    window->line_ending = LINE_ENDING_LF;
+    window->changes->reset(0);
+    memset(&window->file_stat, 0, sizeof(window->file_stat));
+    window->journal->start(NULL, NULL);
+    file_watch(window, NULL);
+    window->follow_dropped = 0;
     window->changed = false;
 }
 
@@ -18,61 +48,77 @@ void on_file_open(Fl_Widget* w, void* v) {
     MainWindow* window = (MainWindow*)v;
     char* filename = fl_file_chooser("Open File", "*", "");
     if (filename) {
-        window->editor->buffer()->loadfile(filename);
-        window->current_filename = filename;
+        file_open_real(window, filename);
     }
 }
 
 void on_file_save(Fl_Widget* w, void* v) {
     MainWindow* window = (MainWindow*)v;
-    if (!window->current_filename) {
+    if (file_open_in_progress(window))
+        return;
+    // Only the tail of a followed file may be left: don't write it over the file
+    if (!window->current_filename || window->follow_dropped) {
         char* filename = fl_file_chooser("Save File", "*", "");
         if (filename) {
-            window->current_filename = filename;
+            set_current_filename(window, filename);
         } else {
             return;
         }
     }
-    window->editor->buffer()->savefile(window->current_filename);
-    window->changed = false;
+    if (file_save_real(window, window->current_filename))
+        window->changed = false;
 }
 
 void on_file_save_as(Fl_Widget* w, void* v) {
     MainWindow* window = (MainWindow*)v;
+    if (file_open_in_progress(window))
+        return;
     char* filename = fl_file_chooser("Save File As", "*", "");
     if (filename) {
-        window->current_filename = filename;
-        window->editor->buffer()->savefile(window->current_filename);
+        set_current_filename(window, filename);
+        file_save_real(window, window->current_filename);
     }
 }
 
-#include <stdlib.h>
-
 void on_file_quit(Fl_Widget* w, void* v) {
     MainWindow* window = (MainWindow*)v;
+    file_open_cancel(window);
+    bool keep_journal = false;
     if (window->changed) {
         int result = fl_choice("The document has been modified. Do you want to save your changes?", "Cancel", "Save", "Don't Save");
         if (result == 0) { // Cancel
             return;
         } else if (result == 1) { // Save
             on_file_save(w, v);
+            // Edits a save failed to write can still be recovered
+            keep_journal = window->changed;
         }
     }
+    if (!keep_journal)
+        window->journal->close();
     exit(0);
 }
 
+// The menu's editing commands reach the buffer without going through the
+// editor's handle(), so they need their own guard against a running load
 void on_edit_undo(Fl_Widget* w, void* v) {
     MainWindow* window = (MainWindow*)v;
+    if (file_open_in_progress(window))
+        return;
     window->undo_manager->undo();
 }
 
 void on_edit_redo(Fl_Widget* w, void* v) {
     MainWindow* window = (MainWindow*)v;
+    if (file_open_in_progress(window))
+        return;
     window->undo_manager->redo();
 }
 
 void on_edit_cut(Fl_Widget* w, void* v) {
     MainWindow* window = (MainWindow*)v;
+    if (file_open_in_progress(window))
+        return;
     Fl_Text_Editor::kf_cut(0, window->editor);
 }
 
@@ -83,6 +129,8 @@ void on_edit_copy(Fl_Widget* w, void* v) {
 
 void on_edit_paste(Fl_Widget* w, void* v) {
     MainWindow* window = (MainWindow*)v;
+    if (file_open_in_progress(window))
+        return;
     Fl_Text_Editor::kf_paste(0, window->editor);
 }
 
@@ -91,3 +139,28 @@ void on_edit_select_all(Fl_Widget* w, void* v) {
     window->editor->take_focus();
     Fl_Text_Editor::kf_select_all(0, window->editor);
 }
+
+void on_search_find(Fl_Widget* w, void* v) {
+    MainWindow* window = (MainWindow*)v;
+    run_dialog_search(window);
+}
+
+void on_search_find_next(Fl_Widget* w, void* v) {
+    MainWindow* window = (MainWindow*)v;
+    search_find_next(window);
+}
+
+void on_search_find_previous(Fl_Widget* w, void* v) {
+    MainWindow* window = (MainWindow*)v;
+    search_find_previous(window);
+}
+
+void on_search_replace(Fl_Widget* w, void* v) {
+    MainWindow* window = (MainWindow*)v;
+    run_dialog_replace(window);
+}
+
+void on_search_jump_to(Fl_Widget* w, void* v) {
+    MainWindow* window = (MainWindow*)v;
+    run_dialog_jump_to(window);
+}
@@ -20,4 +20,10 @@ void on_edit_copy(Fl_Widget*, void*);
 void on_edit_paste(Fl_Widget*, void*);
 void on_edit_select_all(Fl_Widget*, void*);
 
+void on_search_find(Fl_Widget*, void*);
+void on_search_find_next(Fl_Widget*, void*);
+void on_search_find_previous(Fl_Widget*, void*);
+void on_search_replace(Fl_Widget*, void*);
+void on_search_jump_to(Fl_Widget*, void*);
+
 #endif // CALLBACK_FLTK_H
@@ -0,0 +1,27 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#ifndef CASE_FOLD_H
+#define CASE_FOLD_H
+
+#include <stddef.h>
+
+// Unicode simple case folding, from a table built in, so comparing text
+// without case needs no allocation and no library call per character.
+// Only foldings that keep the UTF-8 length are included (which drops a
+// handful such as KELVIN SIGN to "k"), so a caseless match is always as
+// long in bytes as the pattern.
+unsigned int case_fold(unsigned int c);
+
+// Store in out, up to max of them, the code points that fold to the same
+// as c, c included; returns how many there are.
+size_t case_fold_variants(unsigned int c, unsigned int* out, size_t max);
+
+// Decode the UTF-8 character of n bytes at s; (unsigned)-1 if the bytes
+// aren't one.
+unsigned int utf8_decode(const unsigned char* s, size_t n);
+// Encode c into out, which has room for 4 bytes; returns the length
+size_t utf8_encode(unsigned int c, unsigned char* out);
+
+#endif // CASE_FOLD_H
@@ -0,0 +1,88 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#include "change_tracker.h"
+#include <algorithm>
+
+// Past this many ranges the two closest are merged, so an edit never
+// costs more than a pass over a short list
+#define CHANGE_MAX_RANGES  1024
+
+ChangeTracker::ChangeTracker()
+{
+    file_len = 0;
+}
+
+void ChangeTracker::reset(size_t len)
+{
+    file_len = len;
+    changed.clear();
+}
+
+// The edit becomes a range of its own, swallowing any range it overlaps
+// or touches; ranges after it move by what it added or took away
+void ChangeTracker::edited(size_t pos, size_t inserted, size_t deleted)
+{
+    if (inserted == 0 && deleted == 0)
+        return;
+    long long shift = (long long)inserted - (long long)deleted;
+    Range edit = { pos, pos + inserted, shift };
+
+    std::vector<Range>::iterator it = changed.begin();
+    while (it != changed.end() && it->end < pos)
+        ++it;
+    std::vector<Range>::iterator first = it;
+    while (it != changed.end() && it->start <= pos + deleted) {
+        edit.start = std::min(edit.start, it->start);
+        size_t end = it->end > pos + deleted ? it->end - deleted + inserted : pos + inserted;
+        edit.end = std::max(edit.end, end);
+        edit.delta += it->delta;
+        ++it;
+    }
+    for (std::vector<Range>::iterator r = it; r != changed.end(); ++r) {
+        r->start += shift;
+        r->end += shift;
+    }
+    it = changed.erase(first, it);
+    changed.insert(it, edit);
+
+    if (changed.size() > CHANGE_MAX_RANGES)
+        merge_closest();
+}
+
+void ChangeTracker::merge_closest()
+{
+    size_t best = 0;
+    for (size_t i = 1; i + 1 < changed.size(); i++) {
+        if (changed[i + 1].start - changed[i].end < changed[best + 1].start - changed[best].end)
+            best = i;
+    }
+    changed[best].end = changed[best + 1].end;
+    changed[best].delta += changed[best + 1].delta;
+    changed.erase(changed.begin() + best + 1);
+}
+
+size_t ChangeTracker::patch_ranges(size_t doc_len, std::vector<Range>* out) const
+{
+    out->clear();
+    size_t total = 0;
+    long long shift = 0;
+    for (size_t i = 0; i < changed.size(); i++) {
+        shift += changed[i].delta;
+        Range r = { changed[i].start, changed[i].end, 0 };
+        // Text after a range that moved is out of place until the next one
+        if (shift != 0)
+            r.end = i + 1 < changed.size() ? changed[i + 1].start : doc_len;
+        if (r.end == r.start)
+            continue;
+        if (!out->empty() && out->back().end >= r.start) {
+            total += r.end - out->back().end;
+            out->back().end = r.end;
+        } else {
+            total += r.end - r.start;
+            out->push_back(r);
+        }
+    }
+    return total;
+}
@@ -0,0 +1,46 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#ifndef CHANGE_TRACKER_H
+#define CHANGE_TRACKER_H
+
+#include <stddef.h>
+#include <vector>
+
+// Where the document differs from the file it was last read from or
+// written to, kept as a short sorted list of byte ranges. Everything
+// between the ranges is text the file already has, shifted by the length
+// the ranges before it gained or lost. Fed every edit the piece table
+// gets, so a save can write back only what changed.
+class ChangeTracker {
+public:
+    struct Range {
+        size_t start, end;   // in the document as it is now
+        long long delta;     // bytes the range gained over the file's
+    };
+
+    ChangeTracker();
+
+    // The document is now what the file holds, file_len bytes of it
+    void reset(size_t file_len);
+    void edited(size_t pos, size_t inserted, size_t deleted);
+
+    size_t file_length() const { return file_len; }
+    const std::vector<Range>& ranges() const { return changed; }
+
+    // Byte ranges of the document to write at the same offsets in the
+    // file to bring it up to date, given the document is doc_len bytes
+    // now: each changed range, and all that follows it up to the next
+    // point where the text lines up with the file again. Returns the
+    // number of bytes they add up to.
+    size_t patch_ranges(size_t doc_len, std::vector<Range>* out) const;
+
+private:
+    size_t file_len;
+    std::vector<Range> changed;
+
+    void merge_closest();
+};
+
+#endif // CHANGE_TRACKER_H
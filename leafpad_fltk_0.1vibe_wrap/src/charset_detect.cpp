@@ -0,0 +1,614 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#include "charset_detect.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define CHARSET_SIMD 1
+#include <immintrin.h>
+#endif
+
+#define NO_ESC ((size_t)-1)
+
+// ---------------------------------------------------------------------------
+// The single pass
+
+// Where a UTF-8 sequence has got to: continuation bytes still wanted, and
+// the range the next one has to be in
+struct Utf8State {
+    int need;
+    unsigned char lo, hi;
+};
+
+static void scan_bytes(const unsigned char* s, size_t len, size_t base,
+                       Utf8State* st, CharsetScan* scan)
+{
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if (c >= 0x80) {
+            scan->high = true;
+            if (c < 0xA0)
+                scan->c1++;
+            else if (c >= 0xE0)
+                scan->xef++;
+            else if (c >= 0xD0)
+                scan->xd++;
+            else if (c >= 0xC0)
+                scan->xc++;
+        } else if (c == 0x1B && scan->first_esc == NO_ESC) {
+            scan->first_esc = base + i;
+        }
+
+        if (st->need) {
+            if (c < st->lo || c > st->hi) {
+                scan->valid_utf8 = false;
+                st->need = 0;
+            } else {
+                st->need--;
+                st->lo = 0x80;
+                st->hi = 0xBF;
+            }
+            continue;
+        }
+        if (c < 0x80)
+            continue;
+        if (c < 0xC2 || c > 0xF4) {
+            scan->valid_utf8 = false;
+            continue;
+        }
+        // No overlong forms, surrogates or code points past U+10FFFF
+        st->need = c < 0xE0 ? 1 : c < 0xF0 ? 2 : 3;
+        st->lo = c == 0xE0 ? 0xA0 : c == 0xF0 ? 0x90 : 0x80;
+        st->hi = c == 0xED ? 0x9F : c == 0xF4 ? 0x8F : 0xBF;
+    }
+}
+
+#ifndef CHARSET_SIMD
+
+static void scan_scalar(const unsigned char* s, size_t len, CharsetScan* scan)
+{
+    Utf8State st = { 0, 0x80, 0xBF };
+    scan_bytes(s, len, 0, &st, scan);
+    if (st.need)
+        scan->valid_utf8 = false;
+}
+
+#else
+
+static void scan_sse2(const unsigned char* s, size_t len, CharsetScan* scan)
+{
+    const __m128i esc = _mm_set1_epi8(0x1B);
+    Utf8State st = { 0, 0x80, 0xBF };
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i*)(s + i));
+        if (_mm_movemask_epi8(in) || st.need) {
+            scan_bytes(s + i, 16, i, &st, scan);
+            continue;
+        }
+        unsigned int e = _mm_movemask_epi8(_mm_cmpeq_epi8(in, esc));
+        if (e && scan->first_esc == NO_ESC)
+            scan->first_esc = i + __builtin_ctz(e);
+    }
+    scan_bytes(s + i, len - i, i, &st, scan);
+    if (st.need)
+        scan->valid_utf8 = false;
+}
+
+// UTF-8 errors by what a byte and the one before it say, after Keiser and
+// Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte". Each
+// table gives the errors a nibble allows; a pair is bad where all three
+// agree, except that the 2nd and 3rd continuation bytes of 3 and 4 byte
+// sequences are checked by looking two and three bytes back instead.
+enum {
+    TOO_SHORT = 1 << 0,     // lead byte not followed by a continuation
+    TOO_LONG = 1 << 1,      // continuation after ASCII
+    OVERLONG_3 = 1 << 2,
+    TOO_LARGE = 1 << 3,
+    SURROGATE = 1 << 4,
+    OVERLONG_2 = 1 << 5,
+    TOO_LARGE_1000 = 1 << 6,
+    OVERLONG_4 = 1 << 6,
+    TWO_CONTS = 1 << 7,     // continuation after continuation
+    CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS
+};
+
+static const unsigned char byte_1_high[16] = {
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    TOO_SHORT | OVERLONG_2,
+    TOO_SHORT,
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+};
+
+static const unsigned char byte_1_low[16] = {
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    CARRY | OVERLONG_2,
+    CARRY,
+    CARRY,
+    CARRY | TOO_LARGE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000
+};
+
+static const unsigned char byte_2_high[16] = {
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+};
+
+// Bytes above these in the last three places start a sequence that runs
+// on into the next block
+static const unsigned char incomplete_max[32] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+};
+
+__attribute__((target("avx2")))
+static inline int count_equal(__m256i v, int value)
+{
+    return __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)value))));
+}
+
+__attribute__((target("avx2")))
+static void scan_avx2(const unsigned char* s, size_t len, CharsetScan* scan)
+{
+    const __m256i t1_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)byte_1_high));
+    const __m256i t1_low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)byte_1_low));
+    const __m256i t2_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)byte_2_high));
+    const __m256i max = _mm256_loadu_si256((const __m256i*)incomplete_max);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i esc = _mm256_set1_epi8(0x1B);
+    __m256i prev = _mm256_setzero_si256();
+    __m256i error = _mm256_setzero_si256();
+    __m256i incomplete = _mm256_setzero_si256();
+    unsigned char tail[32];
+
+    for (size_t i = 0; i < len; i += 32) {
+        __m256i in;
+        if (i + 32 <= len) {
+            in = _mm256_loadu_si256((const __m256i*)(s + i));
+        } else {
+            // Padding with NULs makes a sequence cut off at the end too short
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, s + i, len - i);
+            in = _mm256_loadu_si256((const __m256i*)tail);
+        }
+        unsigned int e = _mm256_movemask_epi8(_mm256_cmpeq_epi8(in, esc));
+        if (e && scan->first_esc == NO_ESC)
+            scan->first_esc = i + __builtin_ctz(e);
+
+        if (!_mm256_movemask_epi8(in)) {
+            error = _mm256_or_si256(error, incomplete);
+            prev = in;
+            continue;
+        }
+        scan->high = true;
+        __m256i top3 = _mm256_and_si256(in, _mm256_set1_epi8((char)0xE0));
+        __m256i top4 = _mm256_and_si256(in, _mm256_set1_epi8((char)0xF0));
+        scan->c1 += count_equal(top3, 0x80);
+        scan->xc += count_equal(top4, 0xC0);
+        scan->xd += count_equal(top4, 0xD0);
+        scan->xef += count_equal(top3, 0xE0);
+
+        // Each byte beside the one, two and three before it
+        __m256i carry = _mm256_permute2x128_si256(prev, in, 0x21);
+        __m256i prev1 = _mm256_alignr_epi8(in, carry, 15);
+        __m256i prev2 = _mm256_alignr_epi8(in, carry, 14);
+        __m256i prev3 = _mm256_alignr_epi8(in, carry, 13);
+
+        __m256i special = _mm256_and_si256(
+            _mm256_and_si256(
+                _mm256_shuffle_epi8(t1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                _mm256_shuffle_epi8(t1_low, _mm256_and_si256(prev1, nibble))),
+            _mm256_shuffle_epi8(t2_high, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble)));
+        // 0x80 where two or three bytes back is a 3 or 4 byte lead
+        __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+        __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+        __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+        error = _mm256_or_si256(error, _mm256_xor_si256(must23, special));
+
+        incomplete = _mm256_subs_epu8(in, max);
+        prev = in;
+    }
+    error = _mm256_or_si256(error, incomplete);
+    if (!_mm256_testz_si256(error, error))
+        scan->valid_utf8 = false;
+}
+
+#endif // CHARSET_SIMD
+
+void charset_scan(const char* text, size_t len, CharsetScan* scan)
+{
+    const unsigned char* s = (const unsigned char*)text;
+    memset(scan, 0, sizeof(*scan));
+    scan->valid_utf8 = true;
+    scan->first_esc = NO_ESC;
+#ifdef CHARSET_SIMD
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2)
+        scan_avx2(s, len, scan);
+    else
+        scan_sse2(s, len, scan);
+#else
+    scan_scalar(s, len, scan);
+#endif
+    if (scan->first_esc == NO_ESC)
+        scan->first_esc = len;
+}
+
+// ---------------------------------------------------------------------------
+// The verdict, as in the GTK version's encoding.c
+
+#define MAX_COUNTRY_NUM 10
+
+enum {
+    LATIN1 = 0,
+    LATIN2,
+    LATIN3,
+    LATIN4,
+    LATINC,
+    LATINC_UA,
+    LATINC_TJ,
+    LATINA,
+    LATING,
+    LATINH,
+    LATIN5,
+    CHINESE_CN,
+    CHINESE_TW,
+    CHINESE_HK,
+    JAPANESE,
+    KOREAN,
+    VIETNAMESE,
+    THAI,
+    GEORGIAN,
+    END_CODE
+};
+
+enum {
+    IANA = 0,
+    OPENI18N,
+    CODEPAGE,
+    ENCODING_MAX_ITEM_NUM
+};
+
+static const char* country_table[][MAX_COUNTRY_NUM] = {
+    /* LATIN1 */        { NULL },
+    /* LATIN2 */        { "cs", "hr", "hu", "pl", "ro", "sk", "sl", "sq", "sr", "uz" },
+    /* LATIN3 */        { "eo", "mt", NULL },
+    /* LATIN4 */        { "et", "lt", "lv", "mi", NULL },
+    /* LATINC */        { "be", "bg", "ky", "mk", "mn", "ru", "tt", NULL },
+    /* LATINC_UA */     { "uk", NULL },
+    /* LATINC_TJ */     { "tg", NULL },
+    /* LATINA */        { "ar", "fa", "ur", NULL },
+    /* LATING */        { "el", NULL },
+    /* LATINH */        { "he", "yi", NULL },
+    /* LATIN5 */        { "az", "tr", NULL },
+    /* CHINESE_CN */    { "zh_CN", NULL },
+    /* CHINESE_TW */    { "zh_TW", NULL },
+    /* CHINESE_HK */    { "zh_HK", NULL },
+    /* JAPANESE */      { "ja", NULL },
+    /* KOREAN */        { "ko", NULL },
+    /* VIETNAMESE */    { "vi", NULL },
+    /* THAI */          { "th", NULL },
+    /* GEORGIAN */      { "ka", NULL },
+};
+
+static const char* encoding_table[][ENCODING_MAX_ITEM_NUM] = {
+                      /*  IANA           OpenI18N       Codepage */
+    /* LATIN1 */        { "ISO-8859-1",  "ISO-8859-15", "CP1252" },
+    /* LATIN2 */        { "ISO-8859-2",  "ISO-8859-16", "CP1250" },
+    /* LATIN3 */        { "ISO-8859-3",  NULL,          NULL },
+    /* LATIN4 */        { "ISO-8859-4",  "ISO-8859-13", "CP1257" },
+    /* LATINC */        { "ISO-8859-5",  "KOI8-R",      "CP1251" },
+    /* LATINC_UA */     { "ISO-8859-5",  "KOI8-U",      "CP1251" },
+    /* LATINC_TJ */     { "ISO-8859-5",  "KOI8-T",      "CP1251" },
+    /* LATINA */        { "ISO-8859-6",  NULL,          "CP1256" },
+    /* LATING */        { "ISO-8859-7",  NULL,          "CP1253" },
+    /* LATINH */        { "ISO-8859-8",  NULL,          "CP1255" },
+    /* LATIN5 */        { "ISO-8859-9",  NULL,          "CP1254" },
+    /* CHINESE_CN */    { "GB2312",      "GB18030",     "CP936" },
+    /* CHINESE_TW */    { "BIG5",        "EUC-TW",      "CP950" },
+    /* CHINESE_HK */    { "BIG5",        "BIG5-HKSCS",  "CP950" },
+    /* JAPANESE */      { "ISO-2022-JP", "EUC-JP",      "CP932" },
+    /* KOREAN */        { "ISO-2022-KR", "EUC-KR",      "CP949" },
+    /* VIETNAMESE */    { NULL,          "VISCII",      "CP1258" },
+    /* THAI */          { NULL,          "TIS-620",     "CP874" },
+    /* GEORGIAN */      { NULL,          "GEORGIAN-PS", NULL },
+};
+
+// The language group of the locale
+static int get_encoding_code()
+{
+    static int code = END_CODE;
+    if (code != END_CODE)
+        return code;
+    const char* env = getenv("LC_ALL");
+    if (!env)
+        env = getenv("LANG");
+    if (env && strlen(env) >= 2) {
+        for (int j = 1; code == END_CODE && j < END_CODE; j++) {
+            for (int i = 0; i < MAX_COUNTRY_NUM && country_table[j][i]; i++) {
+                if (strncmp(env, country_table[j][i], strlen(country_table[j][i])) == 0) {
+                    code = j;
+                    break;
+                }
+            }
+        }
+    }
+    if (code == END_CODE)
+        code = LATIN1;
+    return code;
+}
+
+static const char* get_encoding_item(int item)
+{
+    return encoding_table[get_encoding_code()][item];
+}
+
+// The locale's codeset, from the part of LC_ALL, LC_CTYPE or LANG after
+// the dot. A locale that doesn't name one is taken to be UTF-8.
+static const char* get_default_charset()
+{
+    static char charset[64];
+    if (charset[0])
+        return charset;
+    const char* names[] = { "LC_ALL", "LC_CTYPE", "LANG" };
+    const char* env = NULL;
+    for (int i = 0; i < 3 && !(env && *env); i++)
+        env = getenv(names[i]);
+    const char* dot = env ? strchr(env, '.') : NULL;
+    if (!dot || !dot[1]) {
+        strcpy(charset, "UTF-8");
+        return charset;
+    }
+    size_t n = strcspn(dot + 1, "@");
+    if (n >= sizeof(charset))
+        n = sizeof(charset) - 1;
+    memcpy(charset, dot + 1, n);
+    charset[n] = '\0';
+    if (strcasecmp(charset, "utf8") == 0 || strcasecmp(charset, "utf-8") == 0)
+        strcpy(charset, "UTF-8");
+    return charset;
+}
+
+// Reads past the end as NUL, as the GTK version's loops met the terminator
+struct ByteReader {
+    const unsigned char* p;
+    const unsigned char* end;
+
+    bool more() const { return p < end; }
+    unsigned char next() { return p < end ? *p++ : 0; }
+};
+
+static const char* detect_charset_cyrillic(const CharsetScan* scan)
+{
+    const char* charset = get_encoding_item(OPENI18N);
+    if (!scan->c1 && scan->xc + scan->xef < scan->xd)
+        charset = "ISO-8859-5";
+    else if (scan->xc + scan->xd < scan->xef)
+        charset = "CP1251";
+    return charset;
+}
+
+static const char* detect_charset_chinese(ByteReader r)
+{
+    const char* charset = get_encoding_item(IANA);
+    while (r.more()) {
+        unsigned char c = r.next();
+        if (c >= 0x81 && c <= 0x87) {
+            return "GB18030";
+        } else if (c >= 0x88 && c <= 0xA0) {
+            c = r.next();
+            if ((c >= 0x30 && c <= 0x39) || (c >= 0x80 && c <= 0xA0))
+                return "GB18030";
+            // else GBK/Big5-HKSCS cannot determine
+        } else if ((c >= 0xA1 && c <= 0xC6) || (c >= 0xC9 && c <= 0xF9)) {
+            c = r.next();
+            if (c >= 0x40 && c <= 0x7E)
+                charset = "BIG5";
+            else if ((c >= 0x30 && c <= 0x39) || (c >= 0x80 && c <= 0xA0))
+                return "GB18030";
+        } else if (c >= 0xC7) {
+            c = r.next();
+            if ((c >= 0x30 && c <= 0x39) || (c >= 0x80 && c <= 0xA0))
+                return "GB18030";
+        }
+    }
+    return charset;
+}
+
+static const char* detect_charset_japanese(ByteReader r)
+{
+    while (r.more()) {
+        unsigned char c = r.next();
+        if (c >= 0x81 && c <= 0x9F) {
+            if (c == 0x8E) /* SS2 */ {
+                c = r.next();
+                if ((c >= 0x40 && c <= 0xA0) || (c >= 0xE0 && c <= 0xFC))
+                    return "CP932";
+            } else if (c == 0x8F) /* SS3 */ {
+                c = r.next();
+                if (c >= 0x40 && c <= 0xA0)
+                    return "CP932";
+                else if (c >= 0xFD)
+                    break;
+            } else {
+                return "CP932";
+            }
+        } else if (c >= 0xA1 && c <= 0xDF) {
+            c = r.next();
+            if (c <= 0x9F)
+                return "CP932";
+            else if (c >= 0xFD)
+                break;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            c = r.next();
+            if (c >= 0x40 && c <= 0xA0)
+                return "CP932";
+            else if (c >= 0xFD)
+                break;
+        } else if (c >= 0xF0) {
+            break;
+        }
+    }
+    return "EUC-JP";
+}
+
+static const char* detect_charset_korean(ByteReader r)
+{
+    bool noneuc = false;
+    bool nonjohab = false;
+    const char* charset = NULL;
+
+    while (charset == NULL && r.more()) {
+        unsigned char c = r.next();
+        if (c >= 0x81 && c < 0x84) {
+            charset = "CP949";
+        } else if (c >= 0x84 && c < 0xA1) {
+            noneuc = true;
+            c = r.next();
+            if ((c > 0x5A && c < 0x61) || (c > 0x7A && c < 0x81))
+                charset = "CP1361";
+            else if (c == 0x52 || c == 0x72 || c == 0x92 || (c > 0x9D && c < 0xA1)
+                || c == 0xB2 || (c > 0xBD && c < 0xC1) || c == 0xD2
+                || (c > 0xDD && c < 0xE1) || c == 0xF2 || c == 0xFE)
+                charset = "CP949";
+        } else if (c >= 0xA1 && c <= 0xC6) {
+            c = r.next();
+            if (c < 0xA1) {
+                noneuc = true;
+                if ((c > 0x5A && c < 0x61) || (c > 0x7A && c < 0x81))
+                    charset = "CP1361";
+                else if (c == 0x52 || c == 0x72 || c == 0x92 || (c > 0x9D && c < 0xA1))
+                    charset = "CP949";
+                else if (c == 0xB2 || (c > 0xBD && c < 0xC1) || c == 0xD2
+                    || (c > 0xDD && c < 0xE1) || c == 0xF2 || c == 0xFE)
+                    nonjohab = true;
+            }
+        } else if (c > 0xC6 && c <= 0xD3) {
+            c = r.next();
+            if (c < 0xA1)
+                charset = "CP1361";
+        } else if (c > 0xD3 && c < 0xD8) {
+            nonjohab = true;
+            r.next();
+        } else if (c >= 0xD8) {
+            c = r.next();
+            if (c < 0xA1)
+                charset = "CP1361";
+        }
+        if (noneuc && nonjohab)
+            charset = "CP949";
+    }
+
+    if (charset == NULL)
+        charset = noneuc ? "CP949" : "EUC-KR";
+    return charset;
+}
+
+// ISO-2022 announces itself with escape sequences, and is 7-bit. Only the
+// escapes are looked at, starting from the first the scan found.
+static const char* detect_iso2022(const char* text, size_t len, size_t from)
+{
+    const char* charset = NULL;
+    const char* end = text + len;
+    const char* p = text + from;
+    while (p < end) {
+        if (end - p >= 3 && p[1] == '$') {
+            switch (p[2]) {
+            case 'B': // JIS X 0208-1983
+            case '@': // JIS X 0208-1978
+                charset = "ISO-2022-JP";
+                break;
+            case 'A': // GB2312-1980
+                return "ISO-2022-JP-2";
+            case '(':
+                if (end - p >= 4 && (p[3] == 'C' || p[3] == 'D')) // KSC5601-1987, JIS X 0212-1990
+                    return "ISO-2022-JP-2";
+                return charset;
+            case ')':
+                if (end - p >= 4 && p[3] == 'C') // KSC5601-1987
+                    return "ISO-2022-KR";
+                return charset;
+            default:
+                return charset;
+            }
+        }
+        p = (const char*)memchr(p + 1, 0x1B, end - p - 1);
+        if (!p)
+            break;
+    }
+    return charset;
+}
+
+const char* detect_charset(const char* text, size_t len, size_t sample)
+{
+    if (sample && sample < len) {
+        // End the sample on a character boundary, in case it's UTF-8
+        size_t n = sample;
+        while (n > 0 && sample - n < 3 && ((unsigned char)text[n] & 0xC0) == 0x80)
+            n--;
+        len = n;
+    }
+
+    CharsetScan scan;
+    charset_scan(text, len, &scan);
+    if (scan.valid_utf8) {
+        if (scan.high)
+            return "UTF-8";
+        const char* charset = detect_iso2022(text, len, scan.first_esc);
+        return charset ? charset : get_default_charset();
+    }
+
+    ByteReader r = { (const unsigned char*)text, (const unsigned char*)text + len };
+    const char* charset;
+    switch (get_encoding_code()) {
+    case LATINC:
+    case LATINC_UA:
+    case LATINC_TJ:
+        return detect_charset_cyrillic(&scan); // fuzzy...
+    case CHINESE_CN:
+    case CHINESE_TW:
+    case CHINESE_HK:
+        return detect_charset_chinese(r);
+    case JAPANESE:
+        return detect_charset_japanese(r);
+    case KOREAN:
+        return detect_charset_korean(r);
+    case VIETNAMESE:
+    case THAI:
+    case GEORGIAN:
+        return get_encoding_item(OPENI18N);
+    default:
+        if (strcmp(get_default_charset(), "UTF-8") != 0)
+            charset = get_default_charset();
+        else if (scan.c1)
+            charset = get_encoding_item(CODEPAGE);
+        else
+            charset = get_encoding_item(OPENI18N);
+        if (!charset)
+            charset = get_encoding_item(IANA);
+        return charset;
+    }
+}
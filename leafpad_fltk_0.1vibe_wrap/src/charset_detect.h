@@ -0,0 +1,35 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#ifndef CHARSET_DETECT_H
+#define CHARSET_DETECT_H
+
+#include <stddef.h>
+
+// What one pass over a file's bytes found out about them
+struct CharsetScan {
+    bool valid_utf8;
+    bool high;          // any byte >= 0x80
+    size_t c1;          // bytes 0x80-0x9F, never text in ISO-8859
+    size_t xc;          // 0xC0-0xCF
+    size_t xd;          // 0xD0-0xDF
+    size_t xef;         // 0xE0-0xFF
+    size_t first_esc;   // offset of the first ESC, or the length if none
+};
+
+// Validate UTF-8, count the high byte ranges and find the first ESC, all
+// in a single pass: 32 bytes at a time with AVX2, where a table lookup on
+// each byte and its three predecessors checks the sequences; with SSE2
+// 16 bytes of ASCII at a time, anything else byte by byte. A sequence cut
+// off by the end of the text counts as invalid.
+void charset_scan(const char* text, size_t len, CharsetScan* scan);
+
+// The charset text is most likely in, decided the way detect_charset()
+// does in the GTK version: UTF-8 or an ISO-2022 escape if the bytes allow
+// it, otherwise a guess from the locale and the high bytes. With a
+// non-zero sample only about that many bytes at the start are looked at,
+// so the verdict comes without reading all of a large file.
+const char* detect_charset(const char* text, size_t len, size_t sample);
+
+#endif // CHARSET_DETECT_H
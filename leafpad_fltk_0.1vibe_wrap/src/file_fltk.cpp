@@ -0,0 +1,973 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#include "file_fltk.h"
+#include "window_fltk.h"
+#include "piece_table.h"
+#include "highlight_fltk.h"
+#include "charset_detect.h"
+#include "line_ending.h"
+#include "change_tracker.h"
+#include "journal.h"
+#include "watch_fltk.h"
+#include <FL/Fl.H>
+#include <FL/Fl_Box.H>
+#include <FL/Fl_Progress.H>
+#include <FL/Fl_Text_Buffer.H>
+#include <FL/fl_ask.H>
+#include <iconv.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+
+// Bytes inserted synchronously so the first screenful shows up at once
+#define LOAD_FIRST_CHUNK   (64 * 1024)
+// Bytes appended per step from the idle callback
+#define LOAD_CHUNK         (1024 * 1024)
+// Time spent appending per idle callback before yielding to the event loop
+#define LOAD_TIME_SLICE    0.02
+// Fl_Text_Buffer positions are ints; anything past this is not loaded
+#define LOAD_MAX_SIZE      ((size_t)INT_MAX - LOAD_CHUNK)
+// Output buffer for charset conversion, on open and on save
+#define CONVERT_BLOCK      (1024 * 1024)
+// Bytes before the old end of a grown file that have to be as they were
+// for the growth to count as an append
+#define TAIL_CHECK         4096
+// Fl_Text_Buffer takes text as C strings, which end at a NUL: a file's
+// NULs are read in as this instead, byte for byte so offsets still match
+#define NUL_REPLACEMENT    '?'
+// What a file that isn't in the charset it was taken for is read as
+#define FALLBACK_CHARSET   "ISO-8859-1"
+// Segments of the document gathered into one writev() on save
+#define SAVE_IOV_MAX       64
+// Files at least this large are patched in place when little has changed
+#define SAVE_PATCH_MIN_SIZE  (16 * 1024 * 1024)
+// and this is the most that is written back that way
+#define SAVE_PATCH_MAX       (64 * 1024 * 1024)
+
+// Bytes at the start of a file looked at to decide its charset by default;
+// scanning all of a huge file would hold up its first screenful
+#define CHARSET_SAMPLE     (4 * 1024 * 1024)
+
+// Bytes looked at to decide the charset, 0 for all of them
+static size_t charset_sample = CHARSET_SAMPLE;
+
+struct FileLoader {
+    MainWindow* window;
+    Fl_Text_Buffer* buffer;
+    int fd;
+    const char* map;   // owned by window->pieces once mapped, unless copying
+    size_t size;       // mapped length
+    size_t total;      // bytes that will be loaded, at most LOAD_MAX_SIZE
+    size_t loaded;
+    size_t released;   // mapped bytes already handed back with MADV_DONTNEED
+    char* chunk;       // NUL-terminated staging copy for Fl_Text_Buffer::insert()
+    int percent;
+    // From the file's charset to UTF-8, or (iconv_t)-1 when the bytes are
+    // loaded as they are
+    iconv_t convert;
+    LineEnding line_ending;
+    bool held_cr;      // a CR at the end of the last block, its LF yet to come
+    // The text is converted, so it is copied into the piece table's add
+    // buffer rather than referred to in the mapping
+    bool copying;
+    // Bytes of the document from nul_start to nul_end had NULs replaced,
+    // so they are not what the file holds
+    size_t nul_start, nul_end;
+};
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void loader_free(FileLoader* loader)
+{
+    if (loader->convert != (iconv_t)-1)
+        iconv_close(loader->convert);
+    if (loader->copying && loader->map)
+        munmap((void*)loader->map, loader->size);
+    if (loader->fd >= 0)
+        close(loader->fd);
+    free(loader->chunk);
+    free(loader);
+}
+
+// Replace the NULs in text with NUL_REPLACEMENT; false if there were
+// none. The range from start to end, if given, is widened to cover them,
+// text being at offset base.
+static bool replace_nuls(char* text, size_t len, size_t base = 0,
+                         size_t* start = NULL, size_t* end = NULL)
+{
+    char* p = (char*)memchr(text, '\0', len);
+    if (!p)
+        return false;
+    char* first = p;
+    char* last = p;
+    for (; p; p = (char*)memchr(p + 1, '\0', len - (p + 1 - text))) {
+        *p = NUL_REPLACEMENT;
+        last = p;
+    }
+    if (start) {
+        if (*start == *end)
+            *start = base + (first - text);
+        *end = base + (last - text) + 1;
+    }
+    return true;
+}
+
+static void loader_update_progress(FileLoader* loader)
+{
+    int percent = loader->total ? (int)(loader->loaded * 100 / loader->total) : 100;
+    if (percent == loader->percent)
+        return;
+    loader->percent = percent;
+
+    char label[64];
+    snprintf(label, sizeof(label), "Loading %d%% (Esc to cancel)", percent);
+    loader->window->progress->value((float)percent);
+    loader->window->progress->copy_label(label);
+}
+
+// Offer to replay the edits a session that died left in the file's
+// journal, and journal the edits of this one from here on
+static void loader_recover(MainWindow* window)
+{
+    if (!window->current_filename || window->file_stat.st_ino == 0) {
+        window->journal->start(NULL, NULL);
+        return;
+    }
+    std::vector<JournalEdit> edits;
+    std::vector<char> text;
+    bool found = EditJournal::load(window->current_filename, &window->file_stat, &edits, &text);
+    // The old journal goes; what is replayed is journaled again
+    window->journal->start(window->current_filename, &window->file_stat);
+    if (!found || fl_choice("Leafpad quit without saving changes to this file.\n"
+                            "Do you want to recover them?", "Discard", "Recover", NULL) != 1)
+        return;
+
+    Fl_Text_Buffer* buffer = window->editor->buffer();
+    window->undo_manager->begin_group();
+    for (size_t i = 0; i < edits.size(); i++) {
+        const JournalEdit& edit = edits[i];
+        size_t len = (size_t)buffer->length();
+        if (edit.pos > len || edit.deleted > len - edit.pos)
+            break;
+        std::string inserted(text.data() + edit.text_offset, edit.inserted);
+        buffer->replace((int)edit.pos, (int)(edit.pos + edit.deleted), inserted.c_str());
+    }
+    window->undo_manager->end_group();
+    window->changed = true;
+}
+
+static void loader_finish(FileLoader* loader, bool cancelled)
+{
+    MainWindow* window = loader->window;
+    bool partial = cancelled || loader->loaded < loader->size;
+
+    window->loader = NULL;
+    window->progress->hide();
+    window->history_status->show();
+    if (partial) {
+        // Don't leave a truncated copy attached to the original file name
+        free(window->current_filename);
+        window->current_filename = NULL;
+        window->status_bar->copy_label(cancelled
+            ? "Loading cancelled, partial document"
+            : "File too large, only the first 2 GB were loaded");
+    } else {
+        window->status_bar->copy_label(window->current_filename);
+    }
+    if (partial || fstat(loader->fd, &window->file_stat) < 0)
+        memset(&window->file_stat, 0, sizeof(window->file_stat));
+
+    // Only now start recording edits: the fill itself is not undoable
+    window->undo_manager->set_buffer(loader->buffer, window->pieces);
+    window->changes->reset(window->pieces->length());
+    // where NULs were replaced, the document is not the file
+    if (loader->nul_end > loader->nul_start)
+        window->changes->edited(loader->nul_start, loader->nul_end - loader->nul_start,
+                                loader->nul_end - loader->nul_start);
+    window->changed = false;
+    loader_free(loader);
+    loader_recover(window);
+    file_watch(window, window->file_stat.st_ino ? window->current_filename : NULL);
+}
+
+// Bytes of the mapping from loaded on to load next, cut after the last
+// newline so that the display never has to lay out half a line (or half a
+// UTF-8 sequence)
+static size_t loader_next_chunk(FileLoader* loader, size_t max)
+{
+    size_t len = loader->total - loader->loaded;
+    const char* src = loader->map + loader->loaded;
+
+    if (len > max) {
+        const char* nl = (const char*)memrchr(src, '\n', max);
+        len = nl ? (size_t)(nl - src) + 1 : max;
+    }
+    return len;
+}
+
+// Drop pages we've copied so RSS doesn't hold the file twice
+static void loader_release_pages(FileLoader* loader)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t done = loader->loaded / page * page;
+    if (done > loader->released) {
+        madvise((void*)(loader->map + loader->released), done - loader->released, MADV_DONTNEED);
+        loader->released = done;
+    }
+}
+
+// Append the next chunk of the mapping. The bytes stay in the mapping,
+// which the piece table refers to, unless NULs in them had to be replaced.
+static void loader_append_chunk(FileLoader* loader, size_t max)
+{
+    size_t len = loader_next_chunk(loader, max);
+    PieceTable* pieces = loader->window->pieces;
+    memcpy(loader->chunk, loader->map + loader->loaded, len);
+    loader->chunk[len] = '\0';
+    bool replaced = replace_nuls(loader->chunk, len, loader->loaded,
+                                 &loader->nul_start, &loader->nul_end);
+    loader->buffer->append(loader->chunk);
+    if (replaced) {
+        pieces->insert(pieces->length(), loader->chunk, len);
+        pieces->skip_original(len);
+    } else {
+        pieces->append_original(len);
+    }
+    loader->loaded += len;
+    loader_release_pages(loader);
+}
+
+// Append text in UTF-8 to the buffer and copy it into the piece table,
+// its line breaks made LF on the way into loader->chunk. The text may lie
+// in the chunk itself, a byte in, to leave room for a held back CR. False
+// if the document would get too long for the buffer.
+static bool loader_append_converted(FileLoader* loader, const char* text, size_t len, bool last)
+{
+    char* out = loader->chunk;
+    size_t n = line_ending_to_lf(text, len, out, loader->line_ending, &loader->held_cr);
+    if (last && loader->held_cr) {
+        out[n++] = '\r';
+        loader->held_cr = false;
+    }
+    PieceTable* pieces = loader->window->pieces;
+    if (pieces->length() + n > LOAD_MAX_SIZE)
+        return false;
+    if (n == 0)
+        return true;
+    out[n] = '\0';
+    replace_nuls(out, n);
+    loader->buffer->append(out);
+    pieces->insert(pieces->length(), out, n);
+    return true;
+}
+
+// The same for a file in another charset or with other line breaks: each
+// chunk goes through iconv a block at a time if need be, and the UTF-8
+// that comes out is copied into the piece table's add buffer with LF
+// line breaks. A character cut off at the end of the chunk is left for
+// the next one. False if the file has bytes the charset doesn't allow.
+static bool loader_convert_chunk(FileLoader* loader, size_t max)
+{
+    size_t len = loader_next_chunk(loader, max);
+    bool last = loader->loaded + len == loader->total;
+    char* in = (char*)loader->map + loader->loaded;
+    size_t in_left = len;
+
+    if (loader->convert == (iconv_t)-1) {
+        if (!loader_append_converted(loader, in, len, last))
+            loader->total = loader->loaded;   // too long for the buffer: stop here
+        else
+            loader->loaded += len;
+        loader_release_pages(loader);
+        return true;
+    }
+
+    for (;;) {
+        // After the last chunk, a stateful charset may have to shift back
+        bool flushing = in_left == 0;
+        char* out = loader->chunk + 1;
+        size_t out_left = CONVERT_BLOCK;
+        size_t r = flushing ? iconv(loader->convert, NULL, NULL, &out, &out_left)
+                            : iconv(loader->convert, &in, &in_left, &out, &out_left);
+        int err = errno;
+        if (!loader_append_converted(loader, loader->chunk + 1, out - (loader->chunk + 1),
+                                     flushing && last)) {
+            loader->total = loader->loaded;
+            return true;
+        }
+        if (r == (size_t)-1) {
+            if (err == E2BIG)
+                continue;
+            if (err == EINVAL && !last && in_left < len)
+                break;
+            return false;
+        }
+        if (flushing || (!in_left && !last))
+            break;
+    }
+    loader->loaded += len - in_left;
+    loader_release_pages(loader);
+    return true;
+}
+
+// Set up conversion from charset, unless the file is UTF-8 already. A
+// charset iconv doesn't know is taken as the fallback.
+static void loader_open_convert(FileLoader* loader, const char* charset)
+{
+    loader->convert = (iconv_t)-1;
+    loader->copying = loader->map && loader->line_ending != LINE_ENDING_LF;
+    if (!loader->map || strcmp(charset, "UTF-8") == 0)
+        return;
+    loader->convert = iconv_open("UTF-8", charset);
+    if (loader->convert == (iconv_t)-1) {
+        charset = FALLBACK_CHARSET;
+        loader->convert = iconv_open("UTF-8", charset);
+    }
+    loader->window->charset = charset;
+    loader->copying = true;
+}
+
+// The file turned out not to be in the charset it was taken for. Like the
+// GTK version, read it again as ISO-8859-1, which any bytes are.
+static void loader_restart_fallback(FileLoader* loader)
+{
+    MainWindow* window = loader->window;
+    window->highlighter->clear();
+    loader->buffer->remove(0, loader->buffer->length());
+    window->pieces->clear();
+    iconv_close(loader->convert);
+    loader->convert = iconv_open("UTF-8", FALLBACK_CHARSET);
+    window->charset = FALLBACK_CHARSET;
+    loader->held_cr = false;
+    loader->loaded = 0;
+    loader->released = 0;
+    loader->percent = -1;
+}
+
+// Load the next chunk whichever way the file needs
+static void loader_step(FileLoader* loader, size_t max)
+{
+    if (!loader->copying)
+        loader_append_chunk(loader, max);
+    else if (!loader_convert_chunk(loader, max))
+        loader_restart_fallback(loader);
+}
+
+static void loader_idle_cb(void* data)
+{
+    FileLoader* loader = (FileLoader*)data;
+    double deadline = now_seconds() + LOAD_TIME_SLICE;
+
+    while (loader->loaded < loader->total) {
+        loader_step(loader, LOAD_CHUNK);
+        if (now_seconds() >= deadline)
+            break;
+    }
+    loader_update_progress(loader);
+
+    if (loader->loaded >= loader->total) {
+        Fl::remove_idle(loader_idle_cb, loader);
+        loader_finish(loader, false);
+    }
+}
+
+bool file_open_real(MainWindow* window, const char* filename)
+{
+    if (window->loader)
+        file_open_cancel(window);
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fl_alert("Can't open file '%s':\n%s", filename, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        fl_alert("Can't open file '%s':\nnot a regular file", filename);
+        close(fd);
+        return false;
+    }
+
+    FileLoader* loader = (FileLoader*)calloc(1, sizeof(FileLoader));
+    loader->window = window;
+    loader->fd = fd;
+    loader->size = (size_t)st.st_size;
+    loader->total = loader->size < LOAD_MAX_SIZE ? loader->size : LOAD_MAX_SIZE;
+    loader->percent = -1;
+    loader->convert = (iconv_t)-1;
+
+    if (loader->size > 0) {
+        void* map = mmap(NULL, loader->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            fl_alert("Can't map file '%s':\n%s", filename, strerror(errno));
+            loader_free(loader);
+            return false;
+        }
+        madvise(map, loader->size, MADV_SEQUENTIAL);
+        loader->map = (const char*)map;
+        // Room for a held back CR and the NUL as well
+        loader->chunk = (char*)malloc(CONVERT_BLOCK + 2);
+    }
+
+    // A buffer sized for the whole file up front: appends never have to
+    // reallocate the gap buffer and copy everything loaded so far.
+    Fl_Text_Buffer* old_buffer = window->editor->buffer();
+    loader->buffer = new Fl_Text_Buffer((int)loader->total + 1, DOCUMENT_GAP);
+    window->highlighter->clear();
+    window->undo_manager->set_buffer(NULL, NULL);
+    window->editor->buffer(loader->buffer);
+    delete old_buffer;
+
+    // The piece table takes the mapping now and each chunk as it's loaded,
+    // counting characters and lines on the way. Text in another charset
+    // is converted a chunk at a time instead, and only the UTF-8 kept.
+    window->charset = loader->map
+        ? detect_charset(loader->map, loader->size, charset_sample) : "UTF-8";
+    loader->line_ending = detect_line_ending(loader->map, loader->size);
+    window->line_ending = loader->line_ending;
+    loader_open_convert(loader, window->charset);
+    if (loader->map && !loader->copying)
+        window->pieces->set_original(loader->map, loader->size);
+    else
+        window->pieces->clear();
+
+    free(window->current_filename);
+    window->current_filename = strdup(filename);
+    window->follow_dropped = 0;
+    window->changed = false;
+    window->loader = loader;
+
+    if (loader->loaded < loader->total)
+        loader_step(loader, LOAD_FIRST_CHUNK);
+
+    if (loader->loaded < loader->total) {
+        loader_update_progress(loader);
+        window->history_status->hide();
+        window->progress->show();
+        window->status_bar->copy_label(filename);
+        Fl::add_idle(loader_idle_cb, loader);
+    } else {
+        loader_finish(loader, false);
+    }
+    return true;
+}
+
+void file_open_cancel(MainWindow* window)
+{
+    FileLoader* loader = window->loader;
+    if (!loader)
+        return;
+    Fl::remove_idle(loader_idle_cb, loader);
+    loader_finish(loader, true);
+}
+
+bool file_open_in_progress(MainWindow* window)
+{
+    return window->loader != NULL;
+}
+
+void file_open_pause(MainWindow* window, bool paused)
+{
+    FileLoader* loader = window->loader;
+    if (!loader)
+        return;
+    if (paused)
+        Fl::remove_idle(loader_idle_cb, loader);
+    else
+        Fl::add_idle(loader_idle_cb, loader);
+}
+
+// Length of the first len bytes of text without a UTF-8 sequence cut off
+// at the end. A byte that no sequence starts with is passed on as it is:
+// held back, it would hold up everything after it.
+static size_t utf8_whole(const char* text, size_t len)
+{
+    for (size_t back = 1; back <= 4 && back <= len; back++) {
+        unsigned char c = (unsigned char)text[len - back];
+        if ((c & 0xC0) == 0x80)
+            continue;
+        size_t need = c < 0x80 || c >= 0xF5 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        return need > back ? len - back : len;
+    }
+    return len;
+}
+
+bool file_appendable(MainWindow* window)
+{
+    return strcmp(window->charset, "UTF-8") == 0 && window->line_ending == LINE_ENDING_LF;
+}
+
+bool file_append_tail(MainWindow* window, size_t max)
+{
+    const char* filename = window->current_filename;
+    size_t doc_len = window->pieces->length();
+    size_t old_len = doc_len + window->follow_dropped;
+    if (!filename || window->loader || window->file_stat.st_ino == 0
+        || !file_appendable(window) || !window->changes->ranges().empty())
+        return false;
+
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_dev != window->file_stat.st_dev
+        || st.st_ino != window->file_stat.st_ino || (size_t)st.st_size <= old_len) {
+        close(fd);
+        return false;
+    }
+    size_t end = old_len + std::min(max, (size_t)st.st_size - old_len);
+    if (doc_len + (end - old_len) > LOAD_MAX_SIZE) {
+        close(fd);
+        return false;
+    }
+
+    // Only the end of what was read is compared: the file was grown, not
+    // rewritten, if that is still there
+    char* chunk = (char*)malloc(LOAD_CHUNK + 1);
+    size_t check = std::min(doc_len, (size_t)TAIL_CHECK);
+    size_t nul_start = 0, nul_end = 0;
+    bool appended = pread(fd, chunk, check, old_len - check) == (ssize_t)check;
+    if (appended)
+        replace_nuls(chunk, check);   // as the document has them
+    appended = appended
+        && window->pieces->copy(doc_len - check, check, chunk + check) == check
+        && memcmp(chunk, chunk + check, check) == 0;
+
+    size_t at = old_len;
+    if (appended) {
+        Fl_Text_Buffer* buffer = window->editor->buffer();
+        window->undo_manager->begin_external();
+        while (at < end) {
+            ssize_t n = pread(fd, chunk, std::min((size_t)LOAD_CHUNK, end - at), at);
+            if (n <= 0)
+                break;
+            // A character the writer is partway through waits for next time
+            size_t len = utf8_whole(chunk, (size_t)n);
+            if (len == 0)
+                break;
+            chunk[len] = '\0';
+            replace_nuls(chunk, len, at - window->follow_dropped, &nul_start, &nul_end);
+            buffer->append(chunk);
+            at += len;
+        }
+        window->undo_manager->end_external();
+
+        // The document is now the file up to at. A followed file isn't
+        // journaled: it would be started afresh every frame.
+        window->file_stat = st;
+        window->file_stat.st_size = (off_t)at;
+        window->changes->reset(window->pieces->length());
+        // bar where NULs were replaced
+        if (nul_end > nul_start)
+            window->changes->edited(nul_start, nul_end - nul_start, nul_end - nul_start);
+        window->journal->start(window->follow || window->follow_dropped ? NULL : filename,
+                               &window->file_stat);
+    }
+    free(chunk);
+    close(fd);
+    return appended;
+}
+
+// Where the text being saved goes: the temporary file fd
+struct SaveStream {
+    int fd;
+    // Segments of the piece table waiting to go out in one writev(); they
+    // stay put while the save runs, unlike the conversion buffers
+    struct iovec iov[SAVE_IOV_MAX];
+    int niov;
+    iconv_t convert;        // UTF-8 to the file's charset, or (iconv_t)-1
+    LineEnding line_ending;
+    char* lines;            // CONVERT_BLOCK bytes of text with its line breaks put back
+    char* out;              // CONVERT_BLOCK bytes
+    char pending[8];        // start of a character cut off by a segment end
+    size_t npending;
+    int error;              // errno of what went wrong, EILSEQ for a
+                            // character the charset doesn't have
+};
+
+// Write out the gathered segments
+static bool save_flush(SaveStream* ss)
+{
+    struct iovec* iov = ss->iov;
+    int n = ss->niov;
+    ss->niov = 0;
+    while (n > 0) {
+        ssize_t done = writev(ss->fd, iov, n);
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            ss->error = errno;
+            return false;
+        }
+        while (n > 0 && (size_t)done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char*)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+    return true;
+}
+
+// Queue a segment of the piece table itself, written out with the next
+// ones without being copied
+static bool save_gather(SaveStream* ss, const char* data, size_t len)
+{
+    if (len == 0)
+        return true;
+    ss->iov[ss->niov].iov_base = (void*)data;
+    ss->iov[ss->niov].iov_len = len;
+    if (++ss->niov == SAVE_IOV_MAX)
+        return save_flush(ss);
+    return true;
+}
+
+static bool save_write(SaveStream* ss, const char* data, size_t len)
+{
+    if (ss->niov && !save_flush(ss))
+        return false;
+    while (len > 0) {
+        ssize_t n = write(ss->fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ss->error = errno;
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Convert and write what iconv takes of in, a block of output at a time
+static bool save_convert(SaveStream* ss, char** in, size_t* in_left)
+{
+    for (;;) {
+        char* out = ss->out;
+        size_t out_left = CONVERT_BLOCK;
+        size_t r = in ? iconv(ss->convert, in, in_left, &out, &out_left)
+                      : iconv(ss->convert, NULL, NULL, &out, &out_left);
+        int err = errno;
+        if (!save_write(ss, ss->out, out - ss->out))
+            return false;
+        if (r != (size_t)-1 || err == EINVAL)
+            return true;
+        if (err != E2BIG) {
+            ss->error = err;
+            return false;
+        }
+    }
+}
+
+static bool save_text(SaveStream* ss, const char* data, size_t len)
+{
+    if (ss->convert == (iconv_t)-1)
+        return save_write(ss, data, len);
+
+    // Finish a character the last segment cut off, with the first bytes
+    // of this one
+    if (ss->npending) {
+        size_t take = std::min(len, sizeof(ss->pending) - ss->npending);
+        memcpy(ss->pending + ss->npending, data, take);
+        char* in = ss->pending;
+        size_t in_left = ss->npending + take;
+        if (!save_convert(ss, &in, &in_left))
+            return false;
+        size_t used = ss->npending + take - in_left;
+        if (used < ss->npending) {
+            // Still not a whole character
+            ss->npending += take;
+            return true;
+        }
+        data += used - ss->npending;
+        len -= used - ss->npending;
+        ss->npending = 0;
+    }
+
+    char* in = (char*)data;
+    size_t in_left = len;
+    if (!save_convert(ss, &in, &in_left))
+        return false;
+    if (in_left > sizeof(ss->pending)) {
+        ss->error = EILSEQ;
+        return false;
+    }
+    memcpy(ss->pending, in, in_left);
+    ss->npending = in_left;
+    return true;
+}
+
+// Each segment of the document, with the file's line breaks put back half
+// a block at a time if they aren't LF, on its way to conversion or disk
+static bool save_segment(const char* data, size_t len, void* arg)
+{
+    SaveStream* ss = (SaveStream*)arg;
+    if (ss->line_ending == LINE_ENDING_LF && ss->convert == (iconv_t)-1)
+        return save_gather(ss, data, len);
+    if (ss->line_ending == LINE_ENDING_LF)
+        return save_text(ss, data, len);
+    while (len > 0) {
+        size_t n = std::min(len, (size_t)CONVERT_BLOCK / 2);
+        size_t out = line_ending_from_lf(data, n, ss->lines, ss->line_ending);
+        if (!save_text(ss, ss->lines, out))
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Stream the document out through ss; false with ss->error set if it failed
+static bool save_stream(MainWindow* window, SaveStream* ss)
+{
+    if (ss->convert != (iconv_t)-1)
+        iconv(ss->convert, NULL, NULL, NULL, NULL);
+    ss->niov = 0;
+    ss->npending = 0;
+    ss->error = 0;
+    window->pieces->for_each_segment(0, window->pieces->length(), save_segment, ss);
+    if (ss->error)
+        return false;
+    if (ss->convert == (iconv_t)-1)
+        return !ss->niov || save_flush(ss);
+    if (ss->npending) {
+        // The document ends with part of a character
+        ss->error = EILSEQ;
+        return false;
+    }
+    return save_convert(ss, NULL, NULL);
+}
+
+// The file a save replaces: what filename links to, if it's a symlink,
+// so that the link itself stays
+static char* save_target(const char* filename)
+{
+    struct stat st;
+    if (lstat(filename, &st) == 0 && S_ISLNK(st.st_mode)) {
+        char* real = realpath(filename, NULL);
+        if (real)
+            return real;
+    }
+    return strdup(filename);
+}
+
+// Create the temporary file a save goes to, next to target so that it can
+// be renamed over it, with target's permissions if it exists. Fills in
+// tmp, which has room for strlen(target) + 16 bytes.
+static int save_open_temp(const char* target, char* tmp)
+{
+    const char* slash = strrchr(target, '/');
+    int dir_len = slash ? (int)(slash - target) + 1 : 0;
+    sprintf(tmp, "%.*s.%s.XXXXXX", dir_len, target, target + dir_len);
+    int fd = mkstemp(tmp);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (stat(target, &st) == 0) {
+        fchmod(fd, st.st_mode & 07777);
+        if (fchown(fd, st.st_uid, st.st_gid) < 0) {
+            // Not ours to give away; the new file is the saver's
+        }
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        fchmod(fd, 0666 & ~mask);
+    }
+    return fd;
+}
+
+struct PatchWriter {
+    int fd;
+    off_t offset;
+    int error;
+};
+
+static bool patch_segment(const char* data, size_t len, void* arg)
+{
+    PatchWriter* pw = (PatchWriter*)arg;
+    while (len > 0) {
+        ssize_t n = pwrite(pw->fd, data, len, pw->offset);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            pw->error = errno;
+            return false;
+        }
+        data += n;
+        len -= n;
+        pw->offset += n;
+    }
+    return true;
+}
+
+bool file_stat_same(const struct stat* a, const struct stat* b)
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino
+        && a->st_size == b->st_size
+        && a->st_mtim.tv_sec == b->st_mtim.tv_sec
+        && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+// Write only what changed back into target, where the document goes byte
+// for byte, target is still the file it was read from or last saved to,
+// and the changes are small beside it. Save time then goes with the size
+// of the edits, not of the file, at the cost of the rename's atomicity.
+// False if any of that doesn't hold, or the writing failed, and the whole
+// file should be written instead.
+static bool save_patch(MainWindow* window, const char* target)
+{
+    PieceTable* pieces = window->pieces;
+    size_t doc_len = pieces->length();
+    size_t file_len = window->changes->file_length();
+    // Not a file that would get shorter: truncating it drops the pages of
+    // the mapping past the new end, private copies or not, and spans
+    // there would then fault
+    if (strcmp(window->charset, "UTF-8") != 0 || window->line_ending != LINE_ENDING_LF
+        || window->file_stat.st_ino == 0 || window->follow_dropped
+        || file_len < SAVE_PATCH_MIN_SIZE || doc_len < file_len)
+        return false;
+    std::vector<ChangeTracker::Range> patch;
+    size_t bytes = window->changes->patch_ranges(doc_len, &patch);
+    if (bytes > SAVE_PATCH_MAX || bytes > file_len / 4)
+        return false;
+
+    int fd = open(target, O_WRONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !file_stat_same(&st, &window->file_stat)) {
+        close(fd);
+        return false;
+    }
+
+    // The piece table and the undo history may still read the old text
+    // through the mapping: keep it in the pages about to be written over
+    bool ok = true;
+    for (size_t i = 0; ok && i < patch.size(); i++)
+        ok = pieces->preserve_original(patch[i].start, patch[i].end - patch[i].start);
+
+    PatchWriter pw;
+    pw.fd = fd;
+    pw.error = 0;
+    for (size_t i = 0; ok && i < patch.size(); i++) {
+        pw.offset = (off_t)patch[i].start;
+        pieces->for_each_segment(patch[i].start, patch[i].end - patch[i].start, patch_segment, &pw);
+        ok = pw.error == 0;
+    }
+    if (ok)
+        ok = fdatasync(fd) == 0;
+    if (close(fd) < 0)
+        ok = false;
+    return ok;
+}
+
+// Make the rename itself durable
+static void save_sync_dir(const char* target)
+{
+    const char* slash = strrchr(target, '/');
+    char* dir = slash ? strndup(target, slash - target + 1) : strdup(".");
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+}
+
+bool file_save_real(MainWindow* window, const char* filename)
+{
+    SaveStream ss;
+    ss.convert = (iconv_t)-1;
+    ss.line_ending = window->line_ending;
+    ss.lines = ss.line_ending != LINE_ENDING_LF ? (char*)malloc(CONVERT_BLOCK) : NULL;
+    ss.out = NULL;
+    if (strcmp(window->charset, "UTF-8") != 0) {
+        ss.convert = iconv_open(window->charset, "UTF-8");
+        if (ss.convert == (iconv_t)-1) {
+            fl_alert("Can't convert codeset to '%s'", window->charset);
+            free(ss.lines);
+            return false;
+        }
+        ss.out = (char*)malloc(CONVERT_BLOCK);
+    }
+
+    // A few edits to a large file are written back in place. Otherwise the
+    // text goes to a new file that only replaces the old one once it is
+    // all on disk: a crash or a full disk leaves the old file as it was,
+    // and the mapping the piece table may still read it through keeps the
+    // old contents
+    char* target = save_target(filename);
+    char* tmp = (char*)malloc(strlen(target) + 16);
+    bool ok = false;
+    ss.error = 0;
+    ss.fd = -1;
+    if (save_patch(window, target)) {
+        ok = true;
+    } else if ((ss.fd = save_open_temp(target, tmp)) < 0) {
+        ss.error = errno;
+    } else {
+        ok = save_stream(window, &ss);
+        if (ok && fsync(ss.fd) < 0) {
+            ss.error = errno;
+            ok = false;
+        }
+        if (close(ss.fd) < 0 && ok) {
+            ss.error = errno;
+            ok = false;
+        }
+        if (ok && rename(tmp, target) < 0) {
+            ss.error = errno;
+            ok = false;
+        }
+        if (ok)
+            save_sync_dir(target);
+        else
+            unlink(tmp);
+    }
+    if (ok) {
+        if (stat(target, &window->file_stat) < 0)
+            memset(&window->file_stat, 0, sizeof(window->file_stat));
+        window->changes->reset(window->pieces->length());
+        window->follow_dropped = 0;
+        window->journal->start(window->file_stat.st_ino ? filename : NULL, &window->file_stat);
+        file_watch(window, window->file_stat.st_ino ? filename : NULL);
+    }
+    if (!ok && ss.error == EILSEQ)
+        fl_alert("Can't convert codeset to '%s'", window->charset);
+    else if (!ok)
+        fl_alert("Can't save file '%s':\n%s", filename, strerror(ss.error));
+    if (ss.convert != (iconv_t)-1)
+        iconv_close(ss.convert);
+    free(ss.lines);
+    free(ss.out);
+    free(tmp);
+    free(target);
+    return ok;
+}
+
+void file_set_charset_sample(size_t bytes)
+{
+    charset_sample = bytes;
+}
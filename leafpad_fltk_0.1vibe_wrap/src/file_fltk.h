@@ -0,0 +1,58 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#ifndef FILE_FLTK_H
+#define FILE_FLTK_H
+
+#include <stddef.h>
+
+class MainWindow;
+struct stat;
+
+// Streaming open: the file is mmapped, the first screenful is inserted
+// right away and the rest is appended from an idle callback while the
+// status bar shows progress. A file in a charset other than UTF-8, or
+// with CR or CR+LF line breaks, is converted as it streams in. Returns
+// false if the file can't be opened.
+bool file_open_real(MainWindow* window, const char* filename);
+
+// Stop a load started by file_open_real(). What is already in the buffer
+// stays there, but the window is detached from the file so that a partial
+// document can't be saved over it by accident.
+void file_open_cancel(MainWindow* window);
+
+bool file_open_in_progress(MainWindow* window);
+// Hold a load where it is, for as long as something reads the document
+// while the event loop runs, and let it carry on
+void file_open_pause(MainWindow* window, bool paused);
+
+// True if a and b describe the same version of the same file
+bool file_stat_same(const struct stat* a, const struct stat* b);
+
+// Whether what is appended to the open file can be read in as it is:
+// the file is UTF-8 with LF line breaks, which need no converting
+bool file_appendable(MainWindow* window);
+
+// The open file grew on disk: append what was added to the document, at
+// most max bytes of it, as text read from the file rather than an
+// undoable edit. Returns false, having changed nothing, unless the
+// document is still the file as read (less what follow mode dropped off
+// its start) and the file was only appended to; it then has to be
+// reloaded instead.
+bool file_append_tail(MainWindow* window, size_t max);
+
+// Write the document to filename in the charset and with the line breaks
+// it was read with, streaming it from the piece table through iconv a
+// block at a time; a UTF-8 document with LF line breaks is written as it
+// is. The text goes to a temporary file beside filename, which is synced
+// and renamed over it, so a failed save leaves the old file as it was.
+// Returns false, after saying why, if the text doesn't convert or the
+// file can't be written.
+bool file_save_real(MainWindow* window, const char* filename);
+
+// Decide a file's charset from at most this many bytes at its start, 4 MB
+// by default; 0 reads the whole file.
+void file_set_charset_sample(size_t bytes);
+
+#endif // FILE_FLTK_H
@@ -0,0 +1,716 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#include "highlight_fltk.h"
+#include "view_fltk.h"
+#include "piece_table.h"
+#include "text_search.h"
+#include <FL/Fl.H>
+#include <FL/Fl_Text_Buffer.H>
+#include <FL/Fl_Box.H>
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Bytes of document one worker searches per step
+#define HIGHLIGHT_CHUNK (1024 * 1024)
+#define HIGHLIGHT_MAX_THREADS 8
+// Time spent painting results per frame, and the frame interval
+#define HIGHLIGHT_PAINT_SLICE 0.004
+#define HIGHLIGHT_FRAME (1.0 / 60)
+// Quiet time after an edit before an interrupted search starts over
+#define HIGHLIGHT_RESTART_DELAY 0.3
+
+#define STYLE_PLAIN 'A'
+#define STYLE_MATCH 'B'
+
+#define NO_MATCH ((size_t)-1)
+
+// What the workers share: a snapshot of the document layout and the order
+// to search it in. Span bytes stay valid while the job runs because any
+// deletion cancels it first (see buffer_predelete_cb).
+struct HighlightJob {
+    const TextSearch* search;
+    std::vector<TextSpan> spans;
+    std::vector<size_t> starts;
+    size_t length;
+    std::vector<size_t> order;   // chunk numbers, those on screen first
+    std::atomic<size_t> next;    // index into order of the next chunk to take
+    std::atomic<size_t> running; // workers still searching
+    std::atomic<bool> cancelled;
+
+    // Results by chunk number. Each worker fills in its own chunks; the UI
+    // thread deletes them once the job is over.
+    std::vector<HighlightChunk*> chunks;
+    // Matches the UI had before the job; not touched while it runs
+    const std::vector<size_t>* previous;
+
+    // Written by the last worker out, once every chunk is in
+    std::atomic<bool> settled;
+    std::vector<size_t> matches;
+    std::vector<size_t> added;     // not in any chunk, still to be painted
+    std::vector<size_t> dropped;   // painted but not matches after all
+};
+
+struct HighlightChunk {
+    size_t chunk;
+    std::vector<size_t> matches;
+    size_t painted;     // matches painted so far, UI thread only
+};
+
+// Highlighters alive, so that a wakeup arriving after one was deleted is
+// recognised and dropped. UI thread only.
+static std::vector<MatchHighlighter*> live_highlighters;
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool snapshot_segment(const char* data, size_t len, void* arg)
+{
+    HighlightJob* job = (HighlightJob*)arg;
+    TextSpan span = { data, len };
+    job->starts.push_back(job->length);
+    job->spans.push_back(span);
+    job->length += len;
+    return true;
+}
+
+// First match lying wholly within [from, end), or NO_MATCH
+typedef size_t (*FirstMatchFunc)(size_t from, size_t end, void* arg);
+
+// Matches are searched for chunk by chunk, or around an edit, but must come
+// out as a search from the start of the document would find them: each one
+// the first at or after the end of the one before. The two agree except
+// where a pattern can overlap itself ("aa" in "aaaa"), and then only near
+// where they started from. cands holds the matches found so far in order,
+// all of them real; every match not listed overlaps one that is.
+//
+// Walks cands from index i, with the previous match ending at q. Before
+// dirty_end there may be matches nobody has looked for. Accepted matches
+// go to out, those not in cands also to added, and the candidates given up
+// to dropped. With stop_when_synced it returns as soon as a candidate is
+// confirmed, since from there on cands is right; the return value is the
+// index of the first candidate not consumed.
+static size_t settle(const std::vector<size_t>& cands, size_t i, size_t q, size_t dirty_end,
+                     size_t plen, bool stop_when_synced, FirstMatchFunc first, void* arg,
+                     std::vector<size_t>* out, std::vector<size_t>* added,
+                     std::vector<size_t>* dropped)
+{
+    bool synced = q >= dirty_end;
+    for (;;) {
+        size_t c = i < cands.size() ? cands[i] : NO_MATCH;
+        if (c != NO_MATCH && c < q) {
+            // overlaps the match before: this stretch is out of step
+            if (out->empty() || c != out->back())
+                dropped->push_back(c);
+            synced = false;
+            i++;
+            continue;
+        }
+        if (synced) {
+            if (c == NO_MATCH || stop_when_synced)
+                break;
+            out->push_back(c);
+            q = c + plen;
+            i++;
+            continue;
+        }
+
+        // Out of step: the next match is the first one at or after q. One
+        // not listed overlaps a dropped candidate or lies before dirty_end,
+        // so it can't start far from either; past that it must be c.
+        size_t bound = std::max(dirty_end, q) + 2 * plen - 1;
+        size_t end = c == NO_MATCH ? bound : std::min(c + plen, bound);
+        size_t m = first(q, end, arg);
+        if (m == NO_MATCH) {
+            if (c == NO_MATCH)
+                break;
+            m = c;
+        }
+        out->push_back(m);
+        q = m + plen;
+        if (m == c) {
+            i++;
+            synced = true;
+            if (stop_when_synced)
+                break;
+        } else {
+            added->push_back(m);
+        }
+    }
+    return i;
+}
+
+static size_t first_in_snapshot(size_t from, size_t end, void* arg)
+{
+    HighlightJob* job = (HighlightJob*)arg;
+    size_t plen = job->search->length();
+    end = std::min(end, job->length);
+    if (from >= end || end - from < plen)
+        return NO_MATCH;
+    std::vector<size_t> m;
+    job->search->find_all(&job->spans[0], &job->starts[0], job->spans.size(),
+                          from, end - plen + 1, &m);
+    return m.empty() ? NO_MATCH : m[0];
+}
+
+struct BufferText {
+    Fl_Text_Buffer* buffer;
+    const TextSearch* search;
+};
+
+static size_t first_in_buffer(size_t from, size_t end, void* arg)
+{
+    BufferText* t = (BufferText*)arg;
+    end = std::min(end, (size_t)t->buffer->length());
+    if (from >= end || end - from < t->search->length())
+        return NO_MATCH;
+    char* text = t->buffer->text_range((int)from, (int)end);
+    const char* hit = t->search->find(text, end - from);
+    size_t m = hit ? from + (hit - text) : NO_MATCH;
+    free(text);
+    return m;
+}
+
+MatchHighlighter::MatchHighlighter(EditorView* view, PieceTable* table)
+{
+    editor = view;
+    pieces = table;
+    text_buffer = NULL;
+    style_buffer = NULL;
+    search = NULL;
+    job = NULL;
+    wake_pending = false;
+    restart_needed = false;
+    changed_cb = NULL;
+    changed_arg = NULL;
+    status_box = NULL;
+    memset(styles, 0, sizeof(styles));
+    live_highlighters.push_back(this);
+}
+
+MatchHighlighter::~MatchHighlighter()
+{
+    changed_cb = NULL;
+    status_box = NULL;
+    clear();
+    live_highlighters.erase(std::find(live_highlighters.begin(), live_highlighters.end(), this));
+}
+
+size_t MatchHighlighter::length() const
+{
+    return search ? search->length() : 0;
+}
+
+bool MatchHighlighter::next_match(size_t from, size_t* match) const
+{
+    std::vector<size_t>::const_iterator it = std::lower_bound(found.begin(), found.end(), from);
+    if (it == found.end())
+        return false;
+    *match = *it;
+    return true;
+}
+
+bool MatchHighlighter::previous_match(size_t to, size_t* match) const
+{
+    size_t plen = length();
+    if (to < plen)
+        return false;
+    std::vector<size_t>::const_iterator it = std::upper_bound(found.begin(), found.end(), to - plen);
+    if (it == found.begin())
+        return false;
+    *match = *(it - 1);
+    return true;
+}
+
+void MatchHighlighter::set_changed_callback(void (*cb)(void* arg), void* arg)
+{
+    changed_cb = cb;
+    changed_arg = arg;
+}
+
+void MatchHighlighter::changed()
+{
+    selection_moved();
+    if (changed_cb)
+        changed_cb(changed_arg);
+}
+
+// Only the index is looked at, so this is cheap enough for every keystroke
+void MatchHighlighter::selection_moved()
+{
+    if (!status_box)
+        return;
+    char label[64];
+    label[0] = '\0';
+    if (!search) {
+        // Nothing is being searched for
+    } else if (!complete()) {
+        snprintf(label, sizeof(label), "Counting matches...");
+    } else if (found.empty()) {
+        snprintf(label, sizeof(label), "No matches");
+    } else {
+        size_t k = found.size();
+        int sel_start, sel_end;
+        if (editor->buffer()->selection_position(&sel_start, &sel_end)
+            && (size_t)(sel_end - sel_start) == search->length()) {
+            std::vector<size_t>::const_iterator it =
+                std::lower_bound(found.begin(), found.end(), (size_t)sel_start);
+            if (it != found.end() && *it == (size_t)sel_start)
+                k = it - found.begin();
+        }
+        if (k < found.size())
+            snprintf(label, sizeof(label), "Match %lu of %lu",
+                     (unsigned long)(k + 1), (unsigned long)found.size());
+        else if (found.size() == 1)
+            snprintf(label, sizeof(label), "1 match");
+        else
+            snprintf(label, sizeof(label), "%lu matches", (unsigned long)found.size());
+    }
+    const char* old = status_box->label();
+    if (!old || strcmp(old, label) != 0)
+        status_box->copy_label(label);
+}
+
+void MatchHighlighter::attach()
+{
+    if (text_buffer == editor->buffer())
+        return;
+    detach();
+    text_buffer = editor->buffer();
+
+    // One style byte per text byte, all plain to begin with
+    int len = text_buffer->length();
+    style_buffer = new Fl_Text_Buffer(len + 1);
+    style_buffer->canUndo(0);
+    std::vector<char> plain(std::min(len, HIGHLIGHT_CHUNK) + 1, STYLE_PLAIN);
+    for (int done = 0; done < len; ) {
+        int n = std::min(len - done, (int)plain.size() - 1);
+        plain[n] = '\0';
+        style_buffer->append(&plain[0]);
+        plain[n] = STYLE_PLAIN;
+        done += n;
+    }
+
+    Fl_Text_Display::Style_Table_Entry plain_style = {
+        editor->textcolor(), editor->textfont(), editor->textsize(), 0
+    };
+    styles[0] = plain_style;
+    styles[1] = plain_style;
+#if defined(FL_API_VERSION) && FL_API_VERSION >= 10400
+    styles[1].attr = Fl_Text_Display::ATTR_BGCOLOR;
+    styles[1].bgcolor = FL_YELLOW;
+#else
+    styles[1].color = FL_RED;
+#endif
+    editor->highlight_data(style_buffer, styles, 2, STYLE_PLAIN, NULL, NULL);
+
+    text_buffer->add_modify_callback(buffer_modified_cb, this);
+    text_buffer->add_predelete_callback(buffer_predelete_cb, this);
+}
+
+void MatchHighlighter::detach()
+{
+    if (!text_buffer)
+        return;
+    text_buffer->remove_modify_callback(buffer_modified_cb, this);
+    text_buffer->remove_predelete_callback(buffer_predelete_cb, this);
+    editor->highlight_data(NULL, NULL, 0, STYLE_PLAIN, NULL, NULL);
+    delete style_buffer;
+    style_buffer = NULL;
+    text_buffer = NULL;
+}
+
+// Style bytes are written in place: no gap moves, no callbacks. The caller
+// redisplays the range.
+void MatchHighlighter::paint(size_t pos, size_t len, char style)
+{
+    for (size_t i = 0; i < len; i++)
+        *style_buffer->address((int)(pos + i)) = style;
+}
+
+// Unpaint what of each dropped match no match in found covers
+void MatchHighlighter::unpaint_dropped(const std::vector<size_t>& dropped)
+{
+    size_t plen = search->length();
+    for (size_t i = 0; i < dropped.size(); i++) {
+        for (size_t p = dropped[i]; p < dropped[i] + plen; p++) {
+            std::vector<size_t>::iterator it = std::upper_bound(found.begin(), found.end(), p);
+            if (it == found.begin() || p >= *(it - 1) + plen)
+                paint(p, 1, STYLE_PLAIN);
+        }
+        editor->redisplay_range((int)dropped[i], (int)(dropped[i] + plen));
+    }
+}
+
+void MatchHighlighter::start(const char* pattern, size_t len, bool match_case)
+{
+    cancel_job();
+    Fl::remove_timeout(restart_cb, this);
+    if (style_buffer) {
+        for (size_t i = 0; i < found.size(); i++)
+            paint(found[i], search->length(), STYLE_PLAIN);
+        if (!found.empty())
+            editor->redisplay_range((int)found.front(), (int)(found.back() + search->length()));
+    }
+    found.clear();
+    delete search;
+    search = new TextSearch(pattern, len, match_case);
+
+    attach();
+    start_job();
+    changed();
+}
+
+void MatchHighlighter::clear()
+{
+    cancel_job();
+    Fl::remove_timeout(restart_cb, this);
+    detach();
+    delete search;
+    search = NULL;
+    found.clear();
+    restart_needed = false;
+    changed();
+}
+
+void MatchHighlighter::start_job()
+{
+    restart_needed = false;
+    if (!search || search->length() == 0)
+        return;
+
+    job = new HighlightJob;
+    job->search = search;
+    job->length = 0;
+    job->next = 0;
+    job->cancelled = false;
+    job->settled = false;
+    job->previous = &found;
+    pieces->for_each_segment(0, pieces->length(), snapshot_segment, job);
+    if (job->length < search->length()) {
+        delete job;
+        job = NULL;
+        return;
+    }
+
+    // The chunks on screen, then on to the end, then the ones before
+    size_t n = (job->length + HIGHLIGHT_CHUNK - 1) / HIGHLIGHT_CHUNK;
+    int first, last;
+    editor->visible_range(&first, &last);
+    size_t a = std::min((size_t)std::max(first, 0) / HIGHLIGHT_CHUNK, n - 1);
+    for (size_t c = a; c < n; c++)
+        job->order.push_back(c);
+    for (size_t c = 0; c < a; c++)
+        job->order.push_back(c);
+    job->chunks.assign(n, NULL);
+
+    size_t threads = std::thread::hardware_concurrency();
+    threads = std::max((size_t)1, std::min(threads, (size_t)HIGHLIGHT_MAX_THREADS));
+    threads = std::min(threads, n);
+    job->running = threads;
+    for (size_t i = 0; i < threads; i++)
+        workers.push_back(std::thread(worker_main, this, job));
+    Fl::add_timeout(HIGHLIGHT_FRAME, pump_cb, this);
+}
+
+void MatchHighlighter::worker_main(MatchHighlighter* self, HighlightJob* job)
+{
+    self->worker(job);
+}
+
+// Worker thread: search chunks until none are left, handing each result to
+// the UI thread. The last worker out puts the results in order.
+void MatchHighlighter::worker(HighlightJob* j)
+{
+    bool settle_job = false;
+    for (;;) {
+        size_t k = j->next++;
+        if (j->cancelled || k >= j->order.size()) {
+            settle_job = j->running.fetch_sub(1) == 1 && !j->cancelled;
+            break;
+        }
+
+        HighlightChunk* r = new HighlightChunk;
+        r->chunk = j->order[k];
+        r->painted = 0;
+        size_t from = r->chunk * HIGHLIGHT_CHUNK;
+        size_t to = std::min(from + HIGHLIGHT_CHUNK, j->length);
+        j->search->find_all(&j->spans[0], &j->starts[0], j->spans.size(), from, to, &r->matches);
+        j->chunks[r->chunk] = r;
+
+        bool wake;
+        {
+            std::lock_guard<std::mutex> hold(delivered_lock);
+            delivered.push_back(r);
+            wake = !wake_pending;
+            wake_pending = true;
+        }
+        // The frame timer collects results too, so a full awake queue only
+        // delays them
+        if (wake)
+            Fl::awake(wake_cb, this);
+    }
+    if (!settle_job)
+        return;
+
+    // Every chunk is in: merge them with the matches from before the job
+    // (there are some if it was restarted after an edit) and settle the seams
+    std::vector<size_t> cands;
+    size_t total = 0;
+    for (size_t c = 0; c < j->chunks.size(); c++)
+        total += j->chunks[c]->matches.size();
+    cands.reserve(total);
+    for (size_t c = 0; c < j->chunks.size(); c++)
+        cands.insert(cands.end(), j->chunks[c]->matches.begin(), j->chunks[c]->matches.end());
+    if (!j->previous->empty()) {
+        std::vector<size_t> merged(cands.size() + j->previous->size());
+        std::merge(cands.begin(), cands.end(), j->previous->begin(), j->previous->end(), merged.begin());
+        cands.swap(merged);
+    }
+    j->matches.reserve(cands.size());
+    settle(cands, 0, 0, 0, j->search->length(), false, first_in_snapshot, j,
+           &j->matches, &j->added, &j->dropped);
+    j->settled = true;
+    Fl::awake(wake_cb, this);
+}
+
+void MatchHighlighter::wake_cb(void* data)
+{
+    MatchHighlighter* self = (MatchHighlighter*)data;
+    if (std::find(live_highlighters.begin(), live_highlighters.end(), self) == live_highlighters.end())
+        return;
+    if (self->job)
+        self->pump();
+}
+
+void MatchHighlighter::pump_cb(void* data)
+{
+    MatchHighlighter* self = (MatchHighlighter*)data;
+    if (self->job)
+        self->pump();
+}
+
+// UI thread: take what the workers found and paint as much of it as fits in
+// this frame's slice
+void MatchHighlighter::pump()
+{
+    // Read first: once settled, every chunk has been delivered
+    bool all_in = job->settled;
+    {
+        std::lock_guard<std::mutex> hold(delivered_lock);
+        pending.insert(pending.end(), delivered.begin(), delivered.end());
+        delivered.clear();
+        wake_pending = false;
+    }
+
+    double deadline = now_seconds() + HIGHLIGHT_PAINT_SLICE;
+    size_t plen = search->length();
+    size_t lo = NO_MATCH, hi = 0;
+    bool out_of_time = false;
+    while (!pending.empty() && !out_of_time) {
+        HighlightChunk* r = pending.front();
+        while (r->painted < r->matches.size()) {
+            size_t m = r->matches[r->painted++];
+            paint(m, plen, STYLE_MATCH);
+            lo = std::min(lo, m);
+            hi = std::max(hi, m + plen);
+            if ((r->painted & 255) == 0 && now_seconds() >= deadline) {
+                out_of_time = true;
+                break;
+            }
+        }
+        if (r->painted == r->matches.size())
+            pending.pop_front();
+    }
+    if (lo < hi)
+        editor->redisplay_range((int)lo, (int)hi);
+
+    if (all_in && pending.empty())
+        finish_job();
+    else if (!Fl::has_timeout(pump_cb, this))
+        Fl::add_timeout(HIGHLIGHT_FRAME, pump_cb, this);
+}
+
+void MatchHighlighter::stop_workers()
+{
+    job->cancelled = true;
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    workers.clear();
+    Fl::remove_timeout(pump_cb, this);
+
+    delivered.clear();
+    wake_pending = false;
+    pending.clear();
+    for (size_t c = 0; c < job->chunks.size(); c++)
+        delete job->chunks[c];
+    delete job;
+    job = NULL;
+}
+
+// Every chunk is painted and the last worker has settled the results: take
+// them over and touch up the few places the chunks got wrong
+void MatchHighlighter::finish_job()
+{
+    size_t plen = search->length();
+    found.swap(job->matches);
+    for (size_t i = 0; i < job->added.size(); i++) {
+        paint(job->added[i], plen, STYLE_MATCH);
+        editor->redisplay_range((int)job->added[i], (int)(job->added[i] + plen));
+    }
+    std::vector<size_t> dropped;
+    dropped.swap(job->dropped);
+    stop_workers();
+    unpaint_dropped(dropped);
+    changed();
+}
+
+// Stop a job before it's done. What has been painted is kept, in found; a
+// chunk's matches that overlap another's are dropped without looking
+// further, as the job is searched again from scratch later.
+void MatchHighlighter::cancel_job()
+{
+    if (!job)
+        return;
+    job->cancelled = true;
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    workers.clear();
+
+    std::vector<size_t> cands;
+    for (size_t c = 0; c < job->chunks.size(); c++) {
+        HighlightChunk* r = job->chunks[c];
+        if (r)
+            cands.insert(cands.end(), r->matches.begin(), r->matches.begin() + r->painted);
+    }
+    std::vector<size_t> merged(cands.size() + found.size());
+    std::merge(cands.begin(), cands.end(), found.begin(), found.end(), merged.begin());
+
+    size_t plen = search->length();
+    std::vector<size_t> dropped;
+    found.clear();
+    for (size_t i = 0; i < merged.size(); i++) {
+        if (!found.empty() && merged[i] < found.back() + plen) {
+            if (merged[i] != found.back())
+                dropped.push_back(merged[i]);
+            continue;
+        }
+        found.push_back(merged[i]);
+    }
+    stop_workers();
+    unpaint_dropped(dropped);
+    restart_needed = true;
+}
+
+// Keep the style buffer the same length as the text, and found correct:
+// matches the edit touched are removed, the rest shifted, and the text
+// around the edit searched again.
+void MatchHighlighter::edited(int pos, int inserted, int deleted)
+{
+    if (deleted > 0)
+        style_buffer->remove(pos, pos + deleted);
+    if (inserted > 0) {
+        if (fill.size() < (size_t)inserted + 1)
+            fill.assign(inserted + 1, STYLE_PLAIN);
+        fill[inserted] = '\0';
+        style_buffer->insert(pos, &fill[0]);
+        fill[inserted] = STYLE_PLAIN;
+    }
+
+    size_t plen = search->length();
+    size_t p = pos, ins = inserted, del = deleted;
+    size_t lo = p >= plen - 1 ? p - (plen - 1) : 0;
+    std::vector<size_t>::iterator first = std::lower_bound(found.begin(), found.end(), lo);
+    std::vector<size_t>::iterator last = std::lower_bound(first, found.end(), p + del);
+    for (std::vector<size_t>::iterator it = first; it != last; ++it) {
+        size_t m = *it;
+        if (m < p)
+            paint(m, std::min(m + plen, p) - m, STYLE_PLAIN);
+        if (m + plen > p + del)
+            paint(p + ins, m + plen - (p + del), STYLE_PLAIN);
+    }
+    size_t index = first - found.begin();
+    found.erase(first, last);
+    for (size_t i = index; i < found.size(); i++)
+        found[i] = found[i] - del + ins;
+
+    // Search the edited stretch, carrying on past it until the matches
+    // found line up with the ones already there
+    size_t len = text_buffer->length();
+    size_t q = index > 0 ? found[index - 1] + plen : 0;
+    size_t dirty_end = std::min(len, p + ins + plen - 1);
+    std::vector<size_t> out, added, dropped;
+    // Matches starting before dirty_end, found in one go rather than one
+    // text_range() each
+    size_t window_end = std::min(len, dirty_end + plen - 1);
+    if (q < window_end) {
+        char* text = text_buffer->text_range((int)q, (int)window_end);
+        size_t at = 0;
+        while (const char* hit = search->find(text + at, window_end - q - at)) {
+            size_t m = q + (hit - text);
+            if (m >= dirty_end)
+                break;
+            out.push_back(m);
+            at = m - q + plen;
+        }
+        free(text);
+    }
+    added = out;
+    BufferText text = { text_buffer, search };
+    size_t resume = settle(found, index, out.empty() ? q : out.back() + plen, 0, plen, true,
+                           first_in_buffer, &text, &out, &added, &dropped);
+    found.erase(found.begin() + index, found.begin() + resume);
+    found.insert(found.begin() + index, out.begin(), out.end());
+
+    size_t hi = dirty_end;
+    for (size_t i = 0; i < added.size(); i++) {
+        paint(added[i], plen, STYLE_MATCH);
+        hi = std::max(hi, added[i] + plen);
+    }
+    editor->redisplay_range((int)lo, (int)std::max(hi, lo));
+    unpaint_dropped(dropped);
+}
+
+void MatchHighlighter::restart_cb(void* data)
+{
+    MatchHighlighter* self = (MatchHighlighter*)data;
+    if (self->search && !self->job) {
+        self->start_job();
+        self->changed();
+    }
+}
+
+// Deletions may let the piece table release the bytes a job is reading,
+// so the job is stopped before the text goes
+void MatchHighlighter::buffer_predelete_cb(int, int nDeleted, void* cbArg)
+{
+    MatchHighlighter* self = (MatchHighlighter*)cbArg;
+    if (nDeleted > 0)
+        self->cancel_job();
+}
+
+void MatchHighlighter::buffer_modified_cb(int pos, int nInserted, int nDeleted, int,
+                                          const char*, void* cbArg)
+{
+    MatchHighlighter* self = (MatchHighlighter*)cbArg;
+    if (nInserted == 0 && nDeleted == 0)
+        return;
+    // Results in flight are in old offsets
+    self->cancel_job();
+    self->edited(pos, nInserted, nDeleted);
+    // What was interrupted is searched again once the typing stops
+    if (self->restart_needed) {
+        Fl::remove_timeout(restart_cb, self);
+        Fl::add_timeout(HIGHLIGHT_RESTART_DELAY, restart_cb, self);
+    }
+    self->changed();
+}
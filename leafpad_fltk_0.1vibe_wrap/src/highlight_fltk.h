@@ -0,0 +1,109 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#ifndef HIGHLIGHT_FLTK_H
+#define HIGHLIGHT_FLTK_H
+
+#include <FL/Fl_Text_Display.H>
+#include <stddef.h>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+class Fl_Text_Buffer;
+class Fl_Box;
+class EditorView;
+class PieceTable;
+class TextSearch;
+struct HighlightJob;
+struct HighlightChunk;
+
+// Highlights every match of a search string through a style buffer on the
+// editor, like hlight_searched_strings() in the GTK version, but without
+// blocking. Worker threads search a snapshot of the piece table chunk by
+// chunk, the chunk on screen first; results come back through Fl::awake()
+// and are painted a few milliseconds' worth per frame. Once found, matches
+// are kept up to date edit by edit.
+class MatchHighlighter {
+public:
+    MatchHighlighter(EditorView* view, PieceTable* pieces);
+    ~MatchHighlighter();
+
+    // Highlight all matches of pattern, replacing any current highlighting
+    void start(const char* pattern, size_t len, bool match_case);
+    // Remove all highlighting and stop the search. Must be called before
+    // the editor gets another buffer or the piece table is cleared.
+    void clear();
+
+    bool active() const { return search != NULL; }
+    bool busy() const { return job != NULL; }
+    // True when matches() holds every match: no search is running or
+    // waiting to start over after an edit
+    bool complete() const { return search != NULL && job == NULL && !restart_needed; }
+    size_t length() const;
+    // Document offsets of the matches painted so far, in order. Once
+    // complete, edits keep it up to date without searching again.
+    const std::vector<size_t>& matches() const { return found; }
+    // Binary searches of matches(): the first match starting at or after
+    // from, and the last one ending at or before to
+    bool next_match(size_t from, size_t* match) const;
+    bool previous_match(size_t to, size_t* match) const;
+    // Called after anything that may change matches() or complete()
+    void set_changed_callback(void (*cb)(void* arg), void* arg);
+    // Box showing "Match k of N", or the match count, kept current from the
+    // index alone; selection_moved() is to be called when the selection may
+    // have moved onto or off a match
+    void set_status_box(Fl_Box* box) { status_box = box; }
+    void selection_moved();
+
+private:
+    EditorView* editor;
+    PieceTable* pieces;
+    Fl_Text_Buffer* text_buffer;    // buffer the callbacks are attached to
+    Fl_Text_Buffer* style_buffer;
+    Fl_Text_Display::Style_Table_Entry styles[2];
+    TextSearch* search;
+    std::vector<size_t> found;
+    std::vector<char> fill;         // style bytes for inserted text
+
+    // Search in progress. Workers only read the job and append to
+    // delivered; everything else belongs to the UI thread.
+    HighlightJob* job;
+    std::vector<std::thread> workers;
+    std::mutex delivered_lock;
+    std::vector<HighlightChunk*> delivered;
+    bool wake_pending;
+    std::deque<HighlightChunk*> pending;    // received, not yet painted
+    bool restart_needed;
+    void (*changed_cb)(void* arg);
+    void* changed_arg;
+    Fl_Box* status_box;
+
+    void changed();
+    void attach();
+    void detach();
+    void paint(size_t pos, size_t len, char style);
+    void start_job();
+    void worker(HighlightJob* job);
+    void pump();
+    void finish_job();
+    void cancel_job();
+    void stop_workers();
+    void unpaint_dropped(const std::vector<size_t>& dropped);
+    void edited(int pos, int inserted, int deleted);
+
+    static void worker_main(MatchHighlighter* self, HighlightJob* job);
+    static void wake_cb(void* data);
+    static void pump_cb(void* data);
+    static void restart_cb(void* data);
+    static void buffer_modified_cb(int pos, int nInserted, int nDeleted, int nRestyled,
+                                   const char* deletedText, void* cbArg);
+    static void buffer_predelete_cb(int pos, int nDeleted, void* cbArg);
+
+    MatchHighlighter(const MatchHighlighter&);
+    MatchHighlighter& operator=(const MatchHighlighter&);
+};
+
+#endif // HIGHLIGHT_FLTK_H
@@ -0,0 +1,300 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#include "journal.h"
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+// How long queued edits wait for company before they are written and synced
+#define JOURNAL_COMMIT_MS  300
+
+static const char journal_magic[4] = { 'L', 'P', 'J', '1' };
+
+// On disk: the header, then records until the end or the first one cut
+// short by a crash
+struct JournalHeader {
+    char magic[4];
+    uint32_t path_len;      // followed by the file's path
+    uint64_t size;          // the file as the journal's edits start from
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+};
+
+struct JournalRecord {
+    uint32_t crc;           // of the rest of the record and its text
+    uint32_t reserved;
+    uint64_t pos;
+    uint64_t deleted;
+    uint64_t inserted;      // followed by that many bytes of text
+};
+
+// The file's absolute path, which names its journal
+static std::string journal_key(const char* filename)
+{
+    char* real = realpath(filename, NULL);
+    std::string key = real ? real : filename;
+    free(real);
+    return key;
+}
+
+static std::string journal_dir()
+{
+    const char* cache = getenv("XDG_CACHE_HOME");
+    if (cache && *cache)
+        return std::string(cache) + "/leafpad";
+    const char* home = getenv("HOME");
+    if (home && *home)
+        return std::string(home) + "/.cache/leafpad";
+    const char* tmp = getenv("TMPDIR");
+    return std::string(tmp && *tmp ? tmp : "/tmp") + "/leafpad-journal";
+}
+
+static std::string journal_path(const std::string& key)
+{
+    char name[32];
+    uLong crc = crc32(0L, (const Bytef*)key.data(), (uInt)key.size());
+    snprintf(name, sizeof(name), "/%08lx.journal", (unsigned long)crc);
+    return journal_dir() + name;
+}
+
+static uLong crc_bytes(uLong crc, const char* data, size_t len)
+{
+    while (len > 0) {
+        uInt n = len > UINT_MAX ? UINT_MAX : (uInt)len;
+        crc = crc32(crc, (const Bytef*)data, n);
+        data += n;
+        len -= n;
+    }
+    return crc;
+}
+
+static bool write_all(int fd, const char* data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+EditJournal::EditJournal()
+{
+    switching = false;
+    quitting = false;
+    active = false;
+    fd = -1;
+}
+
+EditJournal::~EditJournal()
+{
+    if (writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> hold(lock);
+            quitting = true;
+        }
+        wake.notify_one();
+        writer.join();
+    }
+    if (fd >= 0)
+        ::close(fd);
+}
+
+void EditJournal::start(const char* filename, const struct stat* st)
+{
+    if (!filename) {
+        if (!active)
+            return;
+        active = false;
+        {
+            std::lock_guard<std::mutex> hold(lock);
+            pending.clear();
+            next_path.clear();
+            switching = true;
+        }
+        wake.notify_one();
+        return;
+    }
+
+    std::string key = journal_key(filename);
+    JournalHeader header;
+    memcpy(header.magic, journal_magic, sizeof(header.magic));
+    header.path_len = (uint32_t)key.size();
+    header.size = (uint64_t)st->st_size;
+    header.mtime_sec = st->st_mtim.tv_sec;
+    header.mtime_nsec = st->st_mtim.tv_nsec;
+
+    {
+        // Edits still queued for the old journal no longer matter
+        std::lock_guard<std::mutex> hold(lock);
+        pending.assign((const char*)&header, (const char*)&header + sizeof(header));
+        pending.insert(pending.end(), key.begin(), key.end());
+        next_path = journal_path(key);
+        switching = true;
+    }
+    active = true;
+    if (!writer.joinable())
+        writer = std::thread(writer_main, this);
+    wake.notify_one();
+}
+
+void EditJournal::close()
+{
+    start(NULL, NULL);
+    if (!writer.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        quitting = true;
+    }
+    wake.notify_one();
+    writer.join();
+}
+
+void EditJournal::record(size_t pos, const char* text, size_t inserted, size_t deleted)
+{
+    if (!active)
+        return;
+    JournalRecord rec;
+    rec.reserved = 0;
+    rec.pos = pos;
+    rec.deleted = deleted;
+    rec.inserted = inserted;
+    uLong crc = crc32(0L, (const Bytef*)&rec.reserved,
+                      sizeof(rec) - offsetof(JournalRecord, reserved));
+    rec.crc = (uint32_t)crc_bytes(crc, text, inserted);
+
+    std::lock_guard<std::mutex> hold(lock);
+    pending.insert(pending.end(), (const char*)&rec, (const char*)&rec + sizeof(rec));
+    pending.insert(pending.end(), text, text + inserted);
+    if (pending.size() == sizeof(rec) + inserted)
+        wake.notify_one();
+}
+
+void EditJournal::writer_main(EditJournal* journal)
+{
+    journal->run();
+}
+
+// Writer thread: take everything queued at once, write it and sync, so the
+// cost of a sync is shared by all the edits of a commit interval
+void EditJournal::run()
+{
+    std::unique_lock<std::mutex> hold(lock);
+    for (;;) {
+        wake.wait(hold, [this] { return quitting || switching || !pending.empty(); });
+        if (!quitting && !switching)
+            wake.wait_for(hold, std::chrono::milliseconds(JOURNAL_COMMIT_MS),
+                          [this] { return quitting || switching; });
+        std::vector<char> batch;
+        batch.swap(pending);
+        bool to_switch = switching;
+        std::string to = next_path;
+        bool done = quitting;
+        switching = false;
+        hold.unlock();
+
+        if (to_switch)
+            switch_file(to);
+        if (fd >= 0 && !batch.empty()) {
+            if (!write_all(fd, batch.data(), batch.size())) {
+                // A journal with a hole in it can't be replayed: give up on it
+                ::close(fd);
+                fd = -1;
+                unlink(path.c_str());
+            } else {
+                fdatasync(fd);
+            }
+        }
+
+        hold.lock();
+        if (done && pending.empty() && !switching)
+            break;
+    }
+}
+
+// Writer thread: move to journal to, emptied, or none if it's empty. The
+// old journal goes unless it's the same file.
+void EditJournal::switch_file(const std::string& to)
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    if (!path.empty() && path != to)
+        unlink(path.c_str());
+    path = to;
+    if (to.empty())
+        return;
+
+    std::string dir = journal_dir();
+    size_t slash = dir.rfind('/');
+    if (slash != std::string::npos && slash > 0)
+        mkdir(dir.substr(0, slash).c_str(), 0700);
+    mkdir(dir.c_str(), 0700);
+    fd = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+}
+
+bool EditJournal::load(const char* filename, const struct stat* st,
+                       std::vector<JournalEdit>* edits, std::vector<char>* text)
+{
+    edits->clear();
+    text->clear();
+    std::string key = journal_key(filename);
+    int jfd = open(journal_path(key).c_str(), O_RDONLY | O_CLOEXEC);
+    if (jfd < 0)
+        return false;
+    std::vector<char> data;
+    char block[64 * 1024];
+    ssize_t n;
+    while ((n = read(jfd, block, sizeof(block))) > 0)
+        data.insert(data.end(), block, block + n);
+    ::close(jfd);
+
+    JournalHeader header;
+    if (data.size() < sizeof(header))
+        return false;
+    memcpy(&header, data.data(), sizeof(header));
+    size_t at = sizeof(header) + header.path_len;
+    if (memcmp(header.magic, journal_magic, sizeof(header.magic)) != 0
+        || at > data.size()
+        || key.compare(0, std::string::npos, data.data() + sizeof(header), header.path_len) != 0
+        || header.size != (uint64_t)st->st_size
+        || header.mtime_sec != (int64_t)st->st_mtim.tv_sec
+        || header.mtime_nsec != (int64_t)st->st_mtim.tv_nsec)
+        return false;
+
+    JournalRecord rec;
+    while (data.size() - at >= sizeof(rec)) {
+        memcpy(&rec, data.data() + at, sizeof(rec));
+        if (rec.inserted > data.size() - at - sizeof(rec))
+            break;
+        const char* rec_text = data.data() + at + sizeof(rec);
+        uLong crc = crc32(0L, (const Bytef*)(data.data() + at + offsetof(JournalRecord, reserved)),
+                          sizeof(rec) - offsetof(JournalRecord, reserved));
+        if ((uint32_t)crc_bytes(crc, rec_text, rec.inserted) != rec.crc)
+            break;
+        JournalEdit edit;
+        edit.pos = rec.pos;
+        edit.deleted = rec.deleted;
+        edit.inserted = rec.inserted;
+        edit.text_offset = text->size();
+        text->insert(text->end(), rec_text, rec_text + rec.inserted);
+        edits->push_back(edit);
+        at += sizeof(rec) + rec.inserted;
+    }
+    return !edits->empty();
+}
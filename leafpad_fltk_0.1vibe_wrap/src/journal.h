@@ -0,0 +1,77 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <sys/stat.h>
+#include <stddef.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One edit read back from a journal; its inserted text is at text_offset
+// in the buffer load() fills
+struct JournalEdit {
+    size_t pos;
+    size_t deleted;
+    size_t inserted;
+    size_t text_offset;
+};
+
+// Write-ahead log of the edits made to a document since its file was last
+// read or written, kept in ~/.cache/leafpad so that a session that dies
+// can be recovered by replaying it onto the file. Edits are queued in
+// memory as they come; a writer thread appends them to the journal and
+// syncs it every few hundred ms, so recording one never waits on the disk.
+class EditJournal {
+public:
+    EditJournal();
+    // Writes out what is queued and stops the writer; the journal stays
+    ~EditJournal();
+
+    // Journal the edits to filename, which st says is what the document
+    // now holds. Whatever was journaled before is dropped. NULL stops
+    // journaling and removes the journal.
+    void start(const char* filename, const struct stat* st);
+    // Remove the journal and wait for the writer to finish, on a clean exit
+    void close();
+
+    // An edit that reached the document: deleted bytes at pos replaced by
+    // inserted bytes of text
+    void record(size_t pos, const char* text, size_t inserted, size_t deleted);
+
+    // Edits a session that didn't end cleanly left in filename's journal,
+    // if the file is still as st says it was then. False if there are
+    // none, or the journal belongs to another version of the file.
+    static bool load(const char* filename, const struct stat* st,
+                     std::vector<JournalEdit>* edits, std::vector<char>* text);
+
+private:
+    // Shared with the writer, under lock
+    std::mutex lock;
+    std::condition_variable wake;
+    std::vector<char> pending;   // records not yet written, after the header on a switch
+    std::string next_path;       // journal to switch to when switching
+    bool switching;
+    bool quitting;
+
+    std::thread writer;
+    bool active;                 // UI thread: a journal is open
+
+    // Writer thread only
+    int fd;
+    std::string path;
+
+    static void writer_main(EditJournal* journal);
+    void run();
+    void switch_file(const std::string& to);
+
+    EditJournal(const EditJournal&);
+    EditJournal& operator=(const EditJournal&);
+};
+
+#endif // JOURNAL_H
@@ -0,0 +1,206 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#include "line_ending.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define LINE_ENDING_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Both kernels run a vector at a time over whole blocks and finish byte by
+// byte. out may be at most as far along as the text: each block is loaded
+// before anything is stored over it.
+
+// Length of the run of text before the first a or b, copied to out unless
+// out is NULL. Nothing past the run is written, so with out behind in the
+// byte that stopped the scan and those after it are still there to read.
+static size_t scan_until_scalar(const char* in, size_t len, char* out, char a, char b)
+{
+    size_t i = 0;
+    for (; i < len && in[i] != a && in[i] != b; i++) {
+        if (out)
+            out[i] = in[i];
+    }
+    return i;
+}
+
+static void replace_scalar(const char* in, size_t len, char* out, char from, char to)
+{
+    for (size_t i = 0; i < len; i++)
+        out[i] = in[i] == from ? to : in[i];
+}
+
+#ifdef LINE_ENDING_SIMD
+
+static size_t scan_until_sse2(const char* in, size_t len, char* out, char a, char b)
+{
+    const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask) {
+            size_t run = __builtin_ctz(mask);
+            if (out)
+                memmove(out + i, in + i, run);
+            return i + run;
+        }
+        if (out)
+            _mm_storeu_si128((__m128i*)(out + i), v);
+    }
+    return i + scan_until_scalar(in + i, len - i, out ? out + i : NULL, a, b);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_until_avx2(const char* in, size_t len, char* out, char a, char b)
+{
+    const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+        if (mask) {
+            size_t run = __builtin_ctz(mask);
+            if (out)
+                memmove(out + i, in + i, run);
+            return i + run;
+        }
+        if (out)
+            _mm256_storeu_si256((__m256i*)(out + i), v);
+    }
+    return i + scan_until_sse2(in + i, len - i, out ? out + i : NULL, a, b);
+}
+
+static void replace_sse2(const char* in, size_t len, char* out, char from, char to)
+{
+    const __m128i vf = _mm_set1_epi8(from), vt = _mm_set1_epi8(to);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i hit = _mm_cmpeq_epi8(v, vf);
+        v = _mm_or_si128(_mm_andnot_si128(hit, v), _mm_and_si128(hit, vt));
+        _mm_storeu_si128((__m128i*)(out + i), v);
+    }
+    replace_scalar(in + i, len - i, out + i, from, to);
+}
+
+__attribute__((target("avx2")))
+static void replace_avx2(const char* in, size_t len, char* out, char from, char to)
+{
+    const __m256i vf = _mm256_set1_epi8(from), vt = _mm256_set1_epi8(to);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+        v = _mm256_blendv_epi8(v, vt, _mm256_cmpeq_epi8(v, vf));
+        _mm256_storeu_si256((__m256i*)(out + i), v);
+    }
+    replace_sse2(in + i, len - i, out + i, from, to);
+}
+
+#endif // LINE_ENDING_SIMD
+
+static size_t scan_until(const char* in, size_t len, char* out, char a, char b)
+{
+#ifdef LINE_ENDING_SIMD
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2)
+        return scan_until_avx2(in, len, out, a, b);
+    return scan_until_sse2(in, len, out, a, b);
+#else
+    return scan_until_scalar(in, len, out, a, b);
+#endif
+}
+
+static void replace_byte(const char* in, size_t len, char* out, char from, char to)
+{
+#ifdef LINE_ENDING_SIMD
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2)
+        replace_avx2(in, len, out, from, to);
+    else
+        replace_sse2(in, len, out, from, to);
+#else
+    replace_scalar(in, len, out, from, to);
+#endif
+}
+
+LineEnding detect_line_ending(const char* text, size_t len)
+{
+    size_t i = scan_until(text, len, NULL, '\r', '\n');
+    if (i == len || text[i] == '\n')
+        return LINE_ENDING_LF;
+    return i + 1 < len && text[i + 1] == '\n' ? LINE_ENDING_CRLF : LINE_ENDING_CR;
+}
+
+size_t line_ending_to_lf(const char* text, size_t len, char* out,
+                         LineEnding eol, bool* held_cr)
+{
+    if (eol == LINE_ENDING_LF) {
+        memmove(out, text, len);
+        return len;
+    }
+    if (eol == LINE_ENDING_CR) {
+        replace_byte(text, len, out, '\r', '\n');
+        return len;
+    }
+
+    char* o = out;
+    size_t i = 0;
+    if (*held_cr && len > 0) {
+        *held_cr = false;
+        if (text[0] == '\n') {
+            *o++ = '\n';
+            i = 1;
+        } else {
+            *o++ = '\r';
+        }
+    }
+    while (i < len) {
+        size_t run = scan_until(text + i, len - i, o, '\r', '\r');
+        o += run;
+        i += run;
+        if (i == len)
+            break;
+        if (i + 1 == len) {
+            *held_cr = true;
+            break;
+        }
+        if (text[i + 1] == '\n') {
+            *o++ = '\n';
+            i += 2;
+        } else {
+            *o++ = '\r';
+            i++;
+        }
+    }
+    return o - out;
+}
+
+size_t line_ending_from_lf(const char* text, size_t len, char* out, LineEnding eol)
+{
+    if (eol == LINE_ENDING_LF) {
+        memcpy(out, text, len);
+        return len;
+    }
+    if (eol == LINE_ENDING_CR) {
+        replace_byte(text, len, out, '\n', '\r');
+        return len;
+    }
+
+    char* o = out;
+    size_t i = 0;
+    while (i < len) {
+        size_t run = scan_until(text + i, len - i, o, '\n', '\n');
+        o += run;
+        i += run;
+        if (i == len)
+            break;
+        *o++ = '\r';
+        *o++ = '\n';
+        i++;
+    }
+    return o - out;
+}
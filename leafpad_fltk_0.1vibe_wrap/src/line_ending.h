@@ -0,0 +1,36 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#ifndef LINE_ENDING_H
+#define LINE_ENDING_H
+
+#include <stddef.h>
+
+// How a file ends its lines. The document itself always uses LF; the
+// others are converted on open and put back on save.
+enum LineEnding {
+    LINE_ENDING_LF,
+    LINE_ENDING_CR,
+    LINE_ENDING_CRLF
+};
+
+// The first line break decides, as in the GTK version
+LineEnding detect_line_ending(const char* text, size_t len);
+
+// Copy len bytes of text to out with the file's line breaks made LF, and
+// return the length written. out may be text itself or lie before it. A
+// text streamed through in blocks keeps *held_cr between calls: a CR at
+// the end of a block is held back until the next shows whether an LF
+// follows, and only a CR+LF pair becomes LF, so a lone CR in a CR+LF file
+// comes back on save as it was. After the last block, a held CR is the
+// caller's to write. out needs room for len + 1 bytes.
+size_t line_ending_to_lf(const char* text, size_t len, char* out,
+                         LineEnding eol, bool* held_cr);
+
+// The other way, for saving: copy text to out with each LF turned into the
+// file's line break, and return the length written. out needs room for
+// twice len bytes for CR+LF, len otherwise.
+size_t line_ending_from_lf(const char* text, size_t len, char* out, LineEnding eol);
+
+#endif // LINE_ENDING_H
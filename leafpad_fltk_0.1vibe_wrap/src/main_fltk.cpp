@@ -3,14 +3,46 @@
  */
 
 #include <FL/Fl.H>
+#include <FL/Fl_Menu_Item.H>
+#include <stdlib.h>
+#include <string.h>
 #include "window_fltk.h"
+#include "file_fltk.h"
+#include "watch_fltk.h"
 
 int main(int argc, char **argv) {
+    // Lets worker threads hand results to the UI with Fl::awake()
+    Fl::lock();
+
     MainWindow *window = new MainWindow(600, 400, "Leafpad");
 
+    // LEAFPAD_UNDO_BUDGET_MB caps the undo history kept in memory
+    const char* budget = getenv("LEAFPAD_UNDO_BUDGET_MB");
+    if (budget && atoi(budget) > 0)
+        window->undo_manager->set_memory_budget((size_t)atoi(budget) * 1024 * 1024);
+    // LEAFPAD_CHARSET_SAMPLE_MB sets how much of the start of a file the
+    // charset is guessed from; 0 reads all of it, however long it takes
+    const char* sample = getenv("LEAFPAD_CHARSET_SAMPLE_MB");
+    if (sample && *sample && atoi(sample) >= 0)
+        file_set_charset_sample((size_t)atoi(sample) * 1024 * 1024);
+    // LEAFPAD_FOLLOW_CAP_MB sets how much of the end of a followed file is
+    // kept in memory, 64 MB by default; 0 keeps all of it
+    const char* cap = getenv("LEAFPAD_FOLLOW_CAP_MB");
+    if (cap && *cap && atoi(cap) >= 0)
+        window->follow_cap = (size_t)atoi(cap) * 1024 * 1024;
+
+    // --follow FILE opens FILE like tail -f
+    if (argc > 2 && strcmp(argv[1], "--follow") == 0) {
+        file_follow(window, true);
+        window->follow_item->set();
+        for (int i = 1; i < argc - 1; i++) {
+            argv[i] = argv[i + 1];
+        }
+        argc--;
+    }
+
     if (argc > 1) {
-        window->editor->buffer()->loadfile(argv[1]);
-        window->current_filename = argv[1];
+        file_open_real(window, argv[1]);
         // Remove the filename from argv so FLTK doesn't parse it
         for (int i = 1; i < argc - 1; i++) {
             argv[i] = argv[i + 1];
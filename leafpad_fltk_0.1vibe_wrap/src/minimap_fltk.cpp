@@ -0,0 +1,109 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#include "minimap_fltk.h"
+#include "window_fltk.h"
+#include "highlight_fltk.h"
+#include "piece_table.h"
+#include <FL/Fl.H>
+#include <FL/Fl_Text_Buffer.H>
+#include <FL/fl_draw.H>
+#include <algorithm>
+
+MatchMinimap::MatchMinimap(int x, int y, int w, int h, MainWindow* win)
+    : Fl_Widget(x, y, w, h)
+{
+    main_win = win;
+    most = 0;
+    stale = true;
+    box(FL_FLAT_BOX);
+    color(FL_BACKGROUND2_COLOR);
+}
+
+void MatchMinimap::update()
+{
+    stale = true;
+    redraw();
+}
+
+void MatchMinimap::resize(int x, int y, int w, int h)
+{
+    if (h != this->h())
+        stale = true;
+    Fl_Widget::resize(x, y, w, h);
+}
+
+// Byte offsets of the lines row stands for. Lines are shared out evenly, as
+// the scrollbar does; with fewer lines than rows a line spans several rows.
+void MatchMinimap::row_range(int row, size_t* start, size_t* end) const
+{
+    PieceTable* pieces = main_win->pieces;
+    size_t lines = pieces->line_count();
+    size_t rows = h() > 0 ? h() : 1;
+    size_t first = lines * row / rows;
+    size_t last = lines * (row + 1) / rows;
+    if (last <= first)
+        last = first + 1;
+    *start = pieces->line_start(first);
+    *end = pieces->line_start(last);
+}
+
+// Two binary searches of the index per row, so the cost depends on the
+// height of the strip, not the number of matches
+void MatchMinimap::count_rows()
+{
+    MatchHighlighter* index = main_win->highlighter;
+    const std::vector<size_t>& found = index->matches();
+    counts.assign(h() > 0 ? h() : 0, 0);
+    most = 0;
+    stale = false;
+    if (!index->active() || found.empty())
+        return;
+    for (int r = 0; r < (int)counts.size(); r++) {
+        size_t start, end;
+        row_range(r, &start, &end);
+        counts[r] = std::lower_bound(found.begin(), found.end(), end)
+                  - std::lower_bound(found.begin(), found.end(), start);
+        most = std::max(most, counts[r]);
+    }
+}
+
+void MatchMinimap::draw()
+{
+    if (stale)
+        count_rows();
+    draw_box();
+    for (int r = 0; r < (int)counts.size(); r++) {
+        if (!counts[r])
+            continue;
+        // A lone match is yellow, the densest row red
+        float weight = most > 1 ? (float)(counts[r] - 1) / (most - 1) : 0;
+        fl_color(fl_color_average(FL_RED, FL_YELLOW, weight));
+        fl_rectf(x() + 1, y() + r, w() - 2, 1);
+    }
+}
+
+int MatchMinimap::handle(int event)
+{
+    if (event != FL_PUSH)
+        return Fl_Widget::handle(event);
+    int row = Fl::event_y() - y();
+    if (row < 0 || row >= h())
+        return 1;
+    size_t start, end, match;
+    row_range(row, &start, &end);
+    EditorView* editor = main_win->editor;
+    MatchHighlighter* index = main_win->highlighter;
+    if (index->active() && index->next_match(start, &match) && match < end) {
+        editor->buffer()->select((int)match, (int)(match + index->length()));
+        editor->insert_position((int)(match + index->length()));
+    } else {
+        editor->buffer()->unselect();
+        editor->insert_position((int)start);
+    }
+    editor->show_insert_position();
+    editor->take_focus();
+    index->selection_moved();
+    return 1;
+}
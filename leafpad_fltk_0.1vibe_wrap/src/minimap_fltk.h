@@ -0,0 +1,40 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#ifndef MINIMAP_FLTK_H
+#define MINIMAP_FLTK_H
+
+#include <FL/Fl_Widget.H>
+#include <stddef.h>
+#include <vector>
+
+class MainWindow;
+
+// A strip beside the editor's scrollbar showing where the highlighted
+// matches are. Each row of pixels stands for a slice of the document's
+// lines and is marked more strongly the more matches it holds; clicking a
+// mark selects the first match there. The counts come from the
+// highlighter's match index and are only worked out again when it changes.
+class MatchMinimap : public Fl_Widget {
+public:
+    MatchMinimap(int x, int y, int w, int h, MainWindow* win);
+
+    // The matches changed: count them again before the next draw
+    void update();
+
+    void draw() override;
+    int handle(int event) override;
+    void resize(int x, int y, int w, int h) override;
+
+private:
+    MainWindow* main_win;
+    std::vector<size_t> counts;     // matches per row
+    size_t most;                    // largest count
+    bool stale;
+
+    void count_rows();
+    void row_range(int row, size_t* start, size_t* end) const;
+};
+
+#endif // MINIMAP_FLTK_H
@@ -0,0 +1,636 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#include "piece_table.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+
+// Typed text is packed into blocks of this size; larger pastes get a block
+// of their own. Blocks never move, so spans into them stay valid.
+#define ADD_BLOCK_SIZE (64 * 1024)
+// Longest piece. Offset lookups finish with a scan inside one piece, and
+// splitting a piece recounts one side of it, so this bounds both.
+#define PIECE_MAX (16 * 1024)
+
+struct PieceNode {
+    TextSpan span;
+    PieceNode* left;
+    PieceNode* right;
+    unsigned int prio;
+    unsigned int span_chars;  // UTF-8 characters starting in this piece
+    unsigned int span_lines;  // newlines in this piece
+    size_t total;      // bytes in this subtree
+    size_t chars;      // characters in this subtree
+    size_t lines;      // newlines in this subtree
+};
+
+static inline size_t node_total(const PieceNode* n)
+{
+    return n ? n->total : 0;
+}
+
+static inline size_t node_chars(const PieceNode* n)
+{
+    return n ? n->chars : 0;
+}
+
+static inline size_t node_lines(const PieceNode* n)
+{
+    return n ? n->lines : 0;
+}
+
+static inline void node_update(PieceNode* n)
+{
+    n->total = n->span.len + node_total(n->left) + node_total(n->right);
+    n->chars = n->span_chars + node_chars(n->left) + node_chars(n->right);
+    n->lines = n->span_lines + node_lines(n->left) + node_lines(n->right);
+}
+
+// Characters (bytes that aren't UTF-8 continuation bytes) and newlines
+static void count_text(const char* p, size_t len, unsigned int* chars, unsigned int* lines)
+{
+    unsigned int c = 0, l = 0;
+    for (size_t i = 0; i < len; i++) {
+        c += ((unsigned char)p[i] & 0xC0) != 0x80;
+        l += p[i] == '\n';
+    }
+    *chars = c;
+    *lines = l;
+}
+
+static PieceNode* merge(PieceNode* a, PieceNode* b)
+{
+    if (!a) return b;
+    if (!b) return a;
+    if (a->prio > b->prio) {
+        a->right = merge(a->right, b);
+        node_update(a);
+        return a;
+    }
+    b->left = merge(a, b->left);
+    node_update(b);
+    return b;
+}
+
+PieceTable::PieceTable()
+{
+    root = nullptr;
+    count = 0;
+    map = nullptr;
+    map_len = 0;
+    map_appended = 0;
+    map_detached = false;
+    seed = 2463534242u;
+}
+
+PieceTable::~PieceTable()
+{
+    clear();
+}
+
+void PieceTable::clear()
+{
+    free_tree(root);
+    root = nullptr;
+    count = 0;
+    for (size_t i = 0; i < add_blocks.size(); i++)
+        free(add_blocks[i].data);
+    add_blocks.clear();
+    if (map)
+        munmap((void*)map, map_len);
+    map = nullptr;
+    map_len = 0;
+    map_appended = 0;
+    map_detached = false;
+}
+
+void PieceTable::set_original(const char* file_map, size_t file_map_len)
+{
+    clear();
+    map = file_map;
+    map_len = file_map_len;
+}
+
+void PieceTable::append_original(size_t len)
+{
+    if (len > map_len - map_appended)
+        len = map_len - map_appended;
+    TextSpan span = { map + map_appended, len };
+    root = merge(root, build(span));
+    map_appended += len;
+}
+
+void PieceTable::skip_original(size_t len)
+{
+    map_appended += std::min(len, map_len - map_appended);
+}
+
+// Writing a byte to each page of the private mapping makes the kernel
+// copy it; from then on the page no longer follows the file
+bool PieceTable::preserve_original(size_t pos, size_t len)
+{
+    if (!map || pos >= map_len || len == 0)
+        return true;
+    len = std::min(len, map_len - pos);
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    char* first = (char*)map + pos / page * page;
+    char* last = (char*)map + pos + len;
+    size_t span = last - first;
+    if (mprotect(first, span, PROT_READ | PROT_WRITE) < 0)
+        return false;
+    for (volatile char* p = first; p < last; p += page)
+        *p = *p;
+    mprotect(first, span, PROT_READ);
+    return true;
+}
+
+struct DetachCopy {
+    const char* map;
+    size_t map_len;
+    char* copy;
+    size_t pos;             // in the document, of the segment
+    PieceReadFunc read;
+    void* arg;
+};
+
+// Only the pointers are looked at: the mapping itself may fault
+static bool detach_segment(const char* data, size_t len, void* arg)
+{
+    DetachCopy* d = (DetachCopy*)arg;
+    if (data >= d->map && data < d->map + d->map_len)
+        d->read(d->pos, len, d->copy + (data - d->map), d->arg);
+    d->pos += len;
+    return true;
+}
+
+bool PieceTable::detach_original(char fill, PieceReadFunc read, void* arg)
+{
+    if (!map || map_detached)
+        return true;
+    void* mem = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return false;
+    memset(mem, fill, map_len);
+    DetachCopy d = { map, map_len, (char*)mem, 0, read, arg };
+    for_each_segment(0, length(), detach_segment, &d);
+    mprotect(mem, map_len, PROT_READ);
+    // Moved over the old mapping in one step, so that a highlighter
+    // thread reading the text finds one or the other, never a hole
+    if (mremap(mem, map_len, map_len, MREMAP_MAYMOVE | MREMAP_FIXED, (void*)map) == MAP_FAILED) {
+        munmap(mem, map_len);
+        return false;
+    }
+    map_detached = true;
+    return true;
+}
+
+size_t PieceTable::length() const
+{
+    return node_total(root);
+}
+
+PieceNode* PieceTable::new_node(TextSpan span)
+{
+    unsigned int chars, lines;
+    count_text(span.data, span.len, &chars, &lines);
+    return new_node(span, chars, lines);
+}
+
+PieceNode* PieceTable::new_node(TextSpan span, unsigned int chars, unsigned int lines)
+{
+    // xorshift32; priorities only need to be well spread
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    PieceNode* n = new PieceNode;
+    n->span = span;
+    n->left = n->right = nullptr;
+    n->prio = seed;
+    n->span_chars = chars;
+    n->span_lines = lines;
+    n->total = span.len;
+    n->chars = n->span_chars;
+    n->lines = n->span_lines;
+    count++;
+    return n;
+}
+
+// Nodes for a span, cut into pieces of at most PIECE_MAX bytes
+PieceNode* PieceTable::build(TextSpan span)
+{
+    PieceNode* tree = nullptr;
+    for (size_t off = 0; off < span.len; off += PIECE_MAX) {
+        TextSpan part = { span.data + off, span.len - off < PIECE_MAX ? span.len - off : PIECE_MAX };
+        tree = merge(tree, new_node(part));
+    }
+    return tree;
+}
+
+void PieceTable::free_tree(PieceNode* node)
+{
+    // iterative so that a degenerate tree can't overflow the stack
+    std::vector<PieceNode*> stack;
+    if (node) stack.push_back(node);
+    while (!stack.empty()) {
+        PieceNode* n = stack.back();
+        stack.pop_back();
+        if (n->left) stack.push_back(n->left);
+        if (n->right) stack.push_back(n->right);
+        delete n;
+    }
+}
+
+// Split so that the first pos bytes end up in *left, cutting a piece in two
+// when pos falls inside it.
+void PieceTable::split(PieceNode* node, size_t pos, PieceNode** left, PieceNode** right)
+{
+    if (!node) {
+        *left = *right = nullptr;
+        return;
+    }
+    size_t left_total = node_total(node->left);
+    if (pos <= left_total) {
+        split(node->left, pos, left, &node->left);
+        node_update(node);
+        *right = node;
+    } else if (pos >= left_total + node->span.len) {
+        split(node->right, pos - left_total - node->span.len, &node->right, right);
+        node_update(node);
+        *left = node;
+    } else {
+        size_t cut = pos - left_total;
+        TextSpan tail = { node->span.data + cut, node->span.len - cut };
+        // recount whichever side is shorter; edits moving through a piece
+        // keep cutting close to one end of it
+        unsigned int chars, lines;
+        if (cut <= tail.len) {
+            count_text(node->span.data, cut, &chars, &lines);
+            chars = node->span_chars - chars;
+            lines = node->span_lines - lines;
+        } else {
+            count_text(tail.data, tail.len, &chars, &lines);
+        }
+        PieceNode* rest = new_node(tail, chars, lines);
+        rest->right = node->right;
+        node_update(rest);
+        node->span.len = cut;
+        node->span_chars -= chars;
+        node->span_lines -= lines;
+        node->right = nullptr;
+        node_update(node);
+        *left = node;
+        *right = rest;
+    }
+}
+
+TextSpan PieceTable::append_add(const char* text, size_t len)
+{
+    if (add_blocks.empty() || add_blocks.back().size - add_blocks.back().used < len) {
+        AddBlock block;
+        block.size = len > ADD_BLOCK_SIZE ? len : ADD_BLOCK_SIZE;
+        block.data = (char*)malloc(block.size);
+        block.used = 0;
+        add_blocks.push_back(block);
+    }
+    AddBlock& block = add_blocks.back();
+    TextSpan span = { block.data + block.used, len };
+    memcpy(block.data + block.used, text, len);
+    block.used += len;
+    return span;
+}
+
+TextSpan PieceTable::insert(size_t pos, const char* text, size_t len)
+{
+    if (len == 0) {
+        TextSpan empty = { nullptr, 0 };
+        return empty;
+    }
+    if (pos > length())
+        pos = length();
+
+    // Remember where the add buffer ends before appending: if the piece just
+    // before pos ends there too, typing simply extends that piece.
+    const char* tail = add_blocks.empty() ? nullptr
+                     : add_blocks.back().data + add_blocks.back().used;
+    TextSpan span = append_add(text, len);
+
+    PieceNode *left, *right;
+    split(root, pos, &left, &right);
+
+    PieceNode* last = left;
+    while (last && last->right)
+        last = last->right;
+    if (last && span.data == tail && last->span.data + last->span.len == tail
+        && last->span.len + len <= PIECE_MAX) {
+        unsigned int chars, lines;
+        count_text(span.data, len, &chars, &lines);
+        for (PieceNode* n = left; n; n = n->right) {
+            n->total += len;
+            n->chars += chars;
+            n->lines += lines;
+        }
+        last->span.len += len;
+        last->span_chars += chars;
+        last->span_lines += lines;
+        root = merge(left, right);
+    } else {
+        root = merge(merge(left, build(span)), right);
+    }
+    return span;
+}
+
+void PieceTable::insert_spans(size_t pos, const TextSpan* spans, size_t n)
+{
+    if (pos > length())
+        pos = length();
+
+    PieceNode* middle = nullptr;
+    for (size_t i = 0; i < n; i++)
+        middle = merge(middle, build(spans[i]));
+
+    PieceNode *left, *right;
+    split(root, pos, &left, &right);
+    root = merge(merge(left, middle), right);
+}
+
+void PieceTable::remove(size_t pos, size_t len, std::vector<TextSpan>* removed)
+{
+    if (pos >= length() || len == 0)
+        return;
+    if (len > length() - pos)
+        len = length() - pos;
+
+    PieceNode *left, *middle, *right;
+    split(root, pos, &left, &right);
+    split(right, len, &middle, &right);
+
+    // in-order, so removed spans come out in document order
+    std::vector<PieceNode*> stack;
+    PieceNode* n = middle;
+    while (n || !stack.empty()) {
+        while (n) {
+            stack.push_back(n);
+            n = n->left;
+        }
+        n = stack.back();
+        stack.pop_back();
+        if (removed)
+            removed->push_back(n->span);
+        PieceNode* next = n->right;
+        delete n;
+        count--;
+        n = next;
+    }
+    root = merge(left, right);
+}
+
+// Index of the add block holding p, or -1; order[] lists the block indices
+// sorted by address.
+static int find_block(const std::vector<int>& order, const char* p,
+                      const std::vector<const char*>& starts, const std::vector<size_t>& sizes)
+{
+    size_t lo = 0, hi = order.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (starts[order[mid]] <= p)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return -1;
+    int b = order[lo - 1];
+    return p < starts[b] + sizes[b] ? b : -1;
+}
+
+size_t PieceTable::release_unused(const std::vector<TextSpan>& keep)
+{
+    size_t n = add_blocks.size();
+    if (n < 2)
+        return 0;
+
+    std::vector<const char*> starts(n);
+    std::vector<size_t> sizes(n);
+    std::vector<int> order(n);
+    std::vector<char> used(n, 0);
+    for (size_t i = 0; i < n; i++) {
+        starts[i] = add_blocks[i].data;
+        sizes[i] = add_blocks[i].size;
+        order[i] = (int)i;
+    }
+    std::sort(order.begin(), order.end(),
+              [&starts](int a, int b) { return starts[a] < starts[b]; });
+
+    // mark: every piece of the document, then everything the caller keeps
+    std::vector<PieceNode*> stack;
+    if (root) stack.push_back(root);
+    while (!stack.empty()) {
+        PieceNode* node = stack.back();
+        stack.pop_back();
+        if (node->left) stack.push_back(node->left);
+        if (node->right) stack.push_back(node->right);
+        if (!in_original(node->span.data)) {
+            int b = find_block(order, node->span.data, starts, sizes);
+            if (b >= 0) used[b] = 1;
+        }
+    }
+    for (size_t i = 0; i < keep.size(); i++) {
+        if (keep[i].len == 0 || in_original(keep[i].data))
+            continue;
+        int b = find_block(order, keep[i].data, starts, sizes);
+        if (b >= 0) used[b] = 1;
+    }
+    // the block being appended to stays, whatever is in it
+    used[n - 1] = 1;
+
+    // sweep, keeping the surviving blocks in their original order
+    size_t freed = 0, out = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (used[i]) {
+            add_blocks[out++] = add_blocks[i];
+        } else {
+            freed += add_blocks[i].size;
+            free(add_blocks[i].data);
+        }
+    }
+    add_blocks.resize(out);
+    return freed;
+}
+
+char PieceTable::byte_at(size_t pos) const
+{
+    const PieceNode* n = root;
+    while (n) {
+        size_t left_total = node_total(n->left);
+        if (pos < left_total) {
+            n = n->left;
+        } else if (pos < left_total + n->span.len) {
+            return n->span.data[pos - left_total];
+        } else {
+            pos -= left_total + n->span.len;
+            n = n->right;
+        }
+    }
+    return '\0';
+}
+
+size_t PieceTable::char_count() const
+{
+    return node_chars(root);
+}
+
+size_t PieceTable::line_count() const
+{
+    return node_lines(root) + 1;
+}
+
+size_t PieceTable::byte_to_char(size_t pos) const
+{
+    size_t chars = 0;
+    const PieceNode* n = root;
+    while (n) {
+        size_t left_total = node_total(n->left);
+        if (pos < left_total) {
+            n = n->left;
+        } else if (pos < left_total + n->span.len) {
+            unsigned int c, l;
+            count_text(n->span.data, pos - left_total, &c, &l);
+            return chars + node_chars(n->left) + c;
+        } else {
+            chars += node_chars(n->left) + n->span_chars;
+            pos -= left_total + n->span.len;
+            n = n->right;
+        }
+    }
+    return chars;
+}
+
+size_t PieceTable::char_to_byte(size_t ch) const
+{
+    size_t pos = 0;
+    const PieceNode* n = root;
+    while (n) {
+        size_t left_chars = node_chars(n->left);
+        if (ch < left_chars) {
+            n = n->left;
+        } else if (ch < left_chars + n->span_chars) {
+            pos += node_total(n->left);
+            size_t k = ch - left_chars;
+            for (size_t i = 0; i < n->span.len; i++) {
+                if (((unsigned char)n->span.data[i] & 0xC0) != 0x80 && k-- == 0)
+                    return pos + i;
+            }
+            return pos + n->span.len;
+        } else {
+            ch -= left_chars + n->span_chars;
+            pos += node_total(n->left) + n->span.len;
+            n = n->right;
+        }
+    }
+    return pos;
+}
+
+size_t PieceTable::byte_to_line(size_t pos) const
+{
+    size_t lines = 0;
+    const PieceNode* n = root;
+    while (n) {
+        size_t left_total = node_total(n->left);
+        if (pos < left_total) {
+            n = n->left;
+        } else if (pos < left_total + n->span.len) {
+            unsigned int c, l;
+            count_text(n->span.data, pos - left_total, &c, &l);
+            return lines + node_lines(n->left) + l;
+        } else {
+            lines += node_lines(n->left) + n->span_lines;
+            pos -= left_total + n->span.len;
+            n = n->right;
+        }
+    }
+    return lines;
+}
+
+size_t PieceTable::line_start(size_t line) const
+{
+    if (line == 0)
+        return 0;
+    // find the line-th newline; the line starts right after it
+    size_t pos = 0;
+    const PieceNode* n = root;
+    while (n) {
+        size_t left_lines = node_lines(n->left);
+        if (line <= left_lines) {
+            n = n->left;
+        } else if (line <= left_lines + n->span_lines) {
+            pos += node_total(n->left);
+            size_t k = line - left_lines;
+            const char* p = n->span.data;
+            const char* end = p + n->span.len;
+            while ((p = (const char*)memchr(p, '\n', end - p)) != nullptr) {
+                p++;
+                if (--k == 0)
+                    return pos + (p - n->span.data);
+            }
+            return pos + n->span.len;
+        } else {
+            line -= left_lines + n->span_lines;
+            pos += node_total(n->left) + n->span.len;
+            n = n->right;
+        }
+    }
+    return length();
+}
+
+// Visit the pieces overlapping [*pos, *pos + *len) under n, whose first byte
+// is at document offset "offset". Advances *pos and shrinks *len as it goes.
+static bool walk_segments(const PieceNode* n, size_t offset, size_t* pos, size_t* len,
+                          PieceSegmentFunc func, void* arg)
+{
+    if (!n || *len == 0 || *pos >= offset + n->total)
+        return true;
+
+    size_t start = offset + node_total(n->left);
+    if (*pos < start && !walk_segments(n->left, offset, pos, len, func, arg))
+        return false;
+
+    if (*len > 0 && *pos < start + n->span.len) {
+        size_t skip = *pos - start;
+        size_t take = n->span.len - skip;
+        if (take > *len) take = *len;
+        if (!func(n->span.data + skip, take, arg))
+            return false;
+        *pos += take;
+        *len -= take;
+    }
+    return walk_segments(n->right, start + n->span.len, pos, len, func, arg);
+}
+
+void PieceTable::for_each_segment(size_t pos, size_t len, PieceSegmentFunc func, void* arg) const
+{
+    walk_segments(root, 0, &pos, &len, func, arg);
+}
+
+static bool copy_segment(const char* data, size_t len, void* arg)
+{
+    char** out = (char**)arg;
+    memcpy(*out, data, len);
+    *out += len;
+    return true;
+}
+
+size_t PieceTable::copy(size_t pos, size_t len, char* out) const
+{
+    if (pos >= length())
+        return 0;
+    if (len > length() - pos)
+        len = length() - pos;
+    char* p = out;
+    for_each_segment(pos, len, copy_segment, &p);
+    return len;
+}
@@ -0,0 +1,126 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#ifndef PIECE_TABLE_H
+#define PIECE_TABLE_H
+
+#include <stddef.h>
+#include <vector>
+
+// A run of bytes owned by the piece table: original text points into the
+// file mapping, everything typed or pasted into the append-only add buffer.
+// Spans stay valid until the table is cleared.
+struct TextSpan {
+    const char* data;
+    size_t len;
+};
+
+struct PieceNode;
+
+// Called for each contiguous run of a range, in order. Return false to stop.
+typedef bool (*PieceSegmentFunc)(const char* data, size_t len, void* arg);
+// Copies len bytes of the document from pos to out, from wherever else
+// it is kept
+typedef void (*PieceReadFunc)(size_t pos, size_t len, char* out, void* arg);
+
+// Document store behind the editor: a treap of pieces keyed by byte offset,
+// so inserting or removing anywhere costs O(log pieces) plus the bytes
+// inserted, independent of document size.
+class PieceTable {
+public:
+    PieceTable();
+    ~PieceTable();
+
+    // Drop all pieces and the add buffer, and unmap the original file.
+    void clear();
+
+    // Make an mmapped file the original text, replacing the document with
+    // an empty one. The table takes ownership of the mapping. The text is
+    // then added with append_original(), so a file can stream in.
+    void set_original(const char* map, size_t map_len);
+    // Append the next len bytes of the mapping to the end of the document.
+    void append_original(size_t len);
+    // Pass over the next len bytes of the mapping, for text that went into
+    // the document some other way
+    void skip_original(size_t len);
+
+    size_t length() const;
+    size_t piece_count() const { return count; }
+
+    // Offset conversions. Every node carries character and newline counts
+    // for its subtree, so these cost O(log pieces) plus a scan of at most
+    // one piece; nothing is rescanned from the start of the document.
+    size_t char_count() const;
+    size_t line_count() const;
+    size_t byte_to_char(size_t pos) const;
+    size_t char_to_byte(size_t ch) const;
+    // Line (0-based) that byte pos is on, and the byte offset where a line
+    // starts; a line past the end maps to length().
+    size_t byte_to_line(size_t pos) const;
+    size_t line_start(size_t line) const;
+
+    // Copy text into the add buffer and splice it in at pos. Returns the
+    // span it now occupies, which stays valid after later edits.
+    TextSpan insert(size_t pos, const char* text, size_t len);
+    // Splice in spans this table handed out earlier, without copying.
+    void insert_spans(size_t pos, const TextSpan* spans, size_t n);
+    // Remove a range; if removed is given, the spans that made it up are
+    // appended to it in order (they stay valid, nothing is freed).
+    void remove(size_t pos, size_t len, std::vector<TextSpan>* removed = nullptr);
+
+    // Copy text into the add buffer without placing it in the document,
+    // for history that comes back from disk.
+    TextSpan store(const char* text, size_t len) { return append_add(text, len); }
+    // Free add-buffer blocks that neither the document nor keep refers to.
+    // Returns the number of bytes released.
+    size_t release_unused(const std::vector<TextSpan>& keep);
+
+    // True if p points into the original file mapping, whose bytes cost no
+    // anonymous memory and can be referred to by offset.
+    bool in_original(const char* p) const { return p >= map && p < map + map_len; }
+    const char* original() const { return map; }
+    // Give the pages of the mapping over bytes [pos, pos + len) of the file
+    // private copies, so that the file can be written there while the
+    // spans that point at them keep the old text. False if that failed.
+    bool preserve_original(size_t pos, size_t len);
+    // The file was cut short or rewritten under the mapping, whose pages
+    // past its new end now fault and may elsewhere show the new text.
+    // Move the original text into anonymous memory at the same address,
+    // so spans handed out stay good: what the document holds is filled in
+    // by read, and text only the history had, lost with the file, reads
+    // as fill. False if there was no memory for it.
+    bool detach_original(char fill, PieceReadFunc read, void* arg);
+
+    char byte_at(size_t pos) const;
+    size_t copy(size_t pos, size_t len, char* out) const;
+    void for_each_segment(size_t pos, size_t len, PieceSegmentFunc func, void* arg) const;
+
+private:
+    struct AddBlock {
+        char* data;
+        size_t used;
+        size_t size;
+    };
+
+    PieceNode* root;
+    size_t count;
+    const char* map;
+    size_t map_len;
+    size_t map_appended;
+    bool map_detached;      // map is anonymous memory, no longer the file
+    std::vector<AddBlock> add_blocks;
+    unsigned int seed;
+
+    TextSpan append_add(const char* text, size_t len);
+    PieceNode* new_node(TextSpan span);
+    PieceNode* new_node(TextSpan span, unsigned int chars, unsigned int lines);
+    PieceNode* build(TextSpan span);
+    void split(PieceNode* node, size_t pos, PieceNode** left, PieceNode** right);
+    void free_tree(PieceNode* node);
+
+    PieceTable(const PieceTable&);
+    PieceTable& operator=(const PieceTable&);
+};
+
+#endif // PIECE_TABLE_H
@@ -0,0 +1,1102 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#include "regex_search.h"
+#include "case_fold.h"
+#include <bitset>
+#include <unordered_map>
+#include <algorithm>
+#include <string.h>
+
+// NFA states a pattern may compile to
+#define REGEX_MAX_STATES 50000
+// Largest count in {m,n}, and deepest nesting of groups
+#define REGEX_MAX_REPEAT 1000
+#define REGEX_MAX_DEPTH 200
+// Memory for the DFA states of one direction; when it's used up the cache
+// starts over, so a pattern whose DFA would be huge costs time, not memory
+#define REGEX_CACHE_BYTES (8 * 1024 * 1024)
+// Bytes scanned between calls to the poll function
+#define REGEX_POLL_BYTES (1024 * 1024)
+
+typedef std::bitset<256> ByteSet;
+
+//
+// Parsing
+//
+
+enum {
+    NODE_EMPTY,
+    NODE_BYTES,       // one byte out of set
+    NODE_CONCAT,
+    NODE_ALT,         // kids in order of preference
+    NODE_REPEAT,      // kids[0], min to max times (max -1: no limit)
+    NODE_LINE_START,
+    NODE_LINE_END
+};
+
+struct RegexNode {
+    int kind;
+    ByteSet set;
+    std::vector<int> kids;
+    int min, max;
+    bool greedy;
+};
+
+struct RegexParser {
+    const unsigned char* p;
+    const unsigned char* end;
+    bool match_case;
+    int depth;
+    std::vector<RegexNode> nodes;
+    std::string error;
+};
+
+static int parse_alt(RegexParser* rp);
+
+static int node_new(RegexParser* rp, int kind)
+{
+    RegexNode n;
+    n.kind = kind;
+    n.min = n.max = 0;
+    n.greedy = true;
+    rp->nodes.push_back(n);
+    return (int)rp->nodes.size() - 1;
+}
+
+static int node_bytes(RegexParser* rp, const ByteSet& set)
+{
+    int n = node_new(rp, NODE_BYTES);
+    rp->nodes[n].set = set;
+    return n;
+}
+
+static int node_pair(RegexParser* rp, int kind, int a, int b)
+{
+    int n = node_new(rp, kind);
+    rp->nodes[n].kids.push_back(a);
+    rp->nodes[n].kids.push_back(b);
+    return n;
+}
+
+static void fold_case(ByteSet* set)
+{
+    for (int c = 'a'; c <= 'z'; c++) {
+        if ((*set)[c] || (*set)[c - 32]) {
+            set->set(c);
+            set->set(c - 32);
+        }
+    }
+}
+
+// A non-ASCII character: a lead byte and its continuation bytes. Stray
+// bytes of broken UTF-8 count as characters too, so "." never gets stuck.
+static int node_any_multibyte(RegexParser* rp)
+{
+    ByteSet lead, cont;
+    for (int b = 0x80; b < 0x100; b++)
+        lead.set(b);
+    for (int b = 0x80; b < 0xC0; b++)
+        cont.set(b);
+    int tail = node_new(rp, NODE_REPEAT);
+    int c = node_bytes(rp, cont);
+    rp->nodes[tail].kids.push_back(c);
+    rp->nodes[tail].min = 0;
+    rp->nodes[tail].max = -1;
+    return node_pair(rp, NODE_CONCAT, node_bytes(rp, lead), tail);
+}
+
+// Any character whose ASCII bytes are those of set, or any non-ASCII one
+static int node_ascii_or_multibyte(RegexParser* rp, const ByteSet& set)
+{
+    return node_pair(rp, NODE_ALT, node_bytes(rp, set), node_any_multibyte(rp));
+}
+
+static ByteSet ascii_complement(const ByteSet& set)
+{
+    ByteSet out;
+    for (int b = 0; b < 0x80; b++) {
+        if (!set[b])
+            out.set(b);
+    }
+    return out;
+}
+
+// Bytes of \d, \w or \s
+static bool escape_set(unsigned char c, ByteSet* set)
+{
+    switch (c | 0x20) {
+    case 'd':
+        for (int b = '0'; b <= '9'; b++)
+            set->set(b);
+        return true;
+    case 'w':
+        for (int b = 0; b < 0x80; b++) {
+            if ((b >= '0' && b <= '9') || (b >= 'a' && b <= 'z') || (b >= 'A' && b <= 'Z') || b == '_')
+                set->set(b);
+        }
+        return true;
+    case 's':
+        set->set(' ');
+        set->set('\t');
+        set->set('\n');
+        set->set('\r');
+        set->set('\f');
+        set->set('\v');
+        return true;
+    }
+    return false;
+}
+
+static int hex_value(unsigned char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// A single-byte escape (rp->p just past the backslash): the byte, or -1
+static int escape_byte(RegexParser* rp)
+{
+    unsigned char c = *rp->p++;
+    switch (c) {
+    case 'n': return '\n';
+    case 't': return '\t';
+    case 'r': return '\r';
+    case 'f': return '\f';
+    case 'v': return '\v';
+    case 'x': {
+        int hi = rp->p < rp->end ? hex_value(rp->p[0]) : -1;
+        int lo = rp->p + 1 < rp->end ? hex_value(rp->p[1]) : -1;
+        if (hi < 0 || lo < 0) {
+            rp->error = "\\x needs two hex digits";
+            return -1;
+        }
+        rp->p += 2;
+        return hi * 16 + lo;
+    }
+    }
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+        rp->error = std::string("unknown escape \\") + (char)c;
+        return -1;
+    }
+    return c;
+}
+
+// Length of the UTF-8 sequence a byte starts, clipped to what is left
+static size_t sequence_length(const unsigned char* p, const unsigned char* end)
+{
+    size_t n = *p >= 0xF0 ? 4 : *p >= 0xE0 ? 3 : *p >= 0xC0 ? 2 : 1;
+    size_t i = 1;
+    while (i < n && p + i < end && (p[i] & 0xC0) == 0x80)
+        i++;
+    return i;
+}
+
+// One character of the pattern taken literally
+static int parse_literal(RegexParser* rp)
+{
+    if (*rp->p < 0x80) {
+        ByteSet set;
+        set.set(*rp->p++);
+        if (!rp->match_case)
+            fold_case(&set);
+        return node_bytes(rp, set);
+    }
+    size_t n = sequence_length(rp->p, rp->end);
+    unsigned int c = utf8_decode(rp->p, n);
+    unsigned int forms[8];
+    size_t k = 1;
+    if (!rp->match_case && c != (unsigned int)-1 && c >= 0x80)
+        k = std::min(case_fold_variants(c, forms, 8), (size_t)8);
+    if (k == 1) {
+        int cat = node_new(rp, NODE_CONCAT);
+        for (size_t i = 0; i < n; i++) {
+            ByteSet set;
+            set.set(*rp->p++);
+            int b = node_bytes(rp, set);
+            rp->nodes[cat].kids.push_back(b);
+        }
+        return cat;
+    }
+
+    // Each form of the letter, which all have the same length
+    rp->p += n;
+    int alt = node_new(rp, NODE_ALT);
+    for (size_t v = 0; v < k; v++) {
+        unsigned char bytes[4];
+        utf8_encode(forms[v], bytes);
+        int cat = node_new(rp, NODE_CONCAT);
+        for (size_t i = 0; i < n; i++) {
+            ByteSet set;
+            set.set(bytes[i]);
+            int b = node_bytes(rp, set);
+            rp->nodes[cat].kids.push_back(b);
+        }
+        rp->nodes[alt].kids.push_back(cat);
+    }
+    return alt;
+}
+
+static int parse_class(RegexParser* rp)
+{
+    rp->p++;
+    bool negate = rp->p < rp->end && *rp->p == '^';
+    if (negate)
+        rp->p++;
+
+    ByteSet set;
+    bool any_multibyte = false;
+    std::vector<int> sequences;
+    for (bool first = true; ; first = false) {
+        if (rp->p == rp->end) {
+            rp->error = "missing ]";
+            return -1;
+        }
+        if (*rp->p == ']' && !first) {
+            rp->p++;
+            break;
+        }
+
+        int lo;
+        if (*rp->p == '\\') {
+            if (++rp->p == rp->end) {
+                rp->error = "missing ]";
+                return -1;
+            }
+            unsigned char c = *rp->p;
+            ByteSet esc;
+            if (escape_set(c, &esc)) {
+                rp->p++;
+                if (c >= 'a') {
+                    set |= esc;
+                } else if (negate) {
+                    rp->error = "\\D, \\S and \\W can't be used in [^...]";
+                    return -1;
+                } else {
+                    set |= ascii_complement(esc);
+                    any_multibyte = true;
+                }
+                continue;
+            }
+            lo = escape_byte(rp);
+            if (lo < 0)
+                return -1;
+        } else if (*rp->p >= 0x80) {
+            if (negate) {
+                rp->error = "non-ASCII characters can't be used in [^...]";
+                return -1;
+            }
+            sequences.push_back(parse_literal(rp));
+            if (rp->p + 1 < rp->end && *rp->p == '-' && rp->p[1] != ']') {
+                rp->error = "ranges of non-ASCII characters are not supported";
+                return -1;
+            }
+            continue;
+        } else {
+            lo = *rp->p++;
+        }
+
+        if (rp->p + 1 < rp->end && *rp->p == '-' && rp->p[1] != ']') {
+            rp->p++;
+            int hi;
+            if (*rp->p == '\\') {
+                rp->p++;
+                hi = rp->p < rp->end ? escape_byte(rp) : -1;
+            } else {
+                hi = *rp->p < 0x80 ? *rp->p++ : -1;
+            }
+            if (hi < lo) {
+                if (rp->error.empty())
+                    rp->error = "bad range in [...]";
+                return -1;
+            }
+            for (int b = lo; b <= hi; b++)
+                set.set(b);
+        } else {
+            set.set(lo);
+        }
+    }
+
+    if (!rp->match_case)
+        fold_case(&set);
+    if (negate)
+        return node_ascii_or_multibyte(rp, ascii_complement(set));
+    int n = node_bytes(rp, set);
+    if (sequences.empty() && !any_multibyte)
+        return n;
+    int alt = node_new(rp, NODE_ALT);
+    rp->nodes[alt].kids.push_back(n);
+    rp->nodes[alt].kids.insert(rp->nodes[alt].kids.end(), sequences.begin(), sequences.end());
+    if (any_multibyte) {
+        int m = node_any_multibyte(rp);
+        rp->nodes[alt].kids.push_back(m);
+    }
+    return alt;
+}
+
+static int parse_atom(RegexParser* rp)
+{
+    unsigned char c = *rp->p;
+    switch (c) {
+    case '(': {
+        rp->p++;
+        if (rp->p + 1 < rp->end && rp->p[0] == '?' && rp->p[1] == ':') {
+            rp->p += 2;
+        } else if (rp->p < rp->end && rp->p[0] == '?') {
+            rp->error = "only (?:...) groups are supported";
+            return -1;
+        }
+        if (++rp->depth > REGEX_MAX_DEPTH) {
+            rp->error = "groups nested too deeply";
+            return -1;
+        }
+        int n = parse_alt(rp);
+        rp->depth--;
+        if (n < 0)
+            return -1;
+        if (rp->p == rp->end || *rp->p != ')') {
+            rp->error = "missing )";
+            return -1;
+        }
+        rp->p++;
+        return n;
+    }
+    case '[':
+        return parse_class(rp);
+    case '.': {
+        rp->p++;
+        ByteSet set;
+        set.set('\n');
+        return node_ascii_or_multibyte(rp, ascii_complement(set));
+    }
+    case '^':
+        rp->p++;
+        return node_new(rp, NODE_LINE_START);
+    case '$':
+        rp->p++;
+        return node_new(rp, NODE_LINE_END);
+    case '\\': {
+        if (++rp->p == rp->end) {
+            rp->error = "trailing backslash";
+            return -1;
+        }
+        c = *rp->p;
+        ByteSet set;
+        if (escape_set(c, &set)) {
+            rp->p++;
+            if (c >= 'a') {
+                if (!rp->match_case)
+                    fold_case(&set);
+                return node_bytes(rp, set);
+            }
+            return node_ascii_or_multibyte(rp, ascii_complement(set));
+        }
+        if (c >= 0x80)
+            return parse_literal(rp);
+        int b = escape_byte(rp);
+        if (b < 0)
+            return -1;
+        set.set(b);
+        if (!rp->match_case)
+            fold_case(&set);
+        return node_bytes(rp, set);
+    }
+    }
+    return parse_literal(rp);
+}
+
+static bool parse_count(RegexParser* rp, const unsigned char** q, int* value)
+{
+    const unsigned char* s = *q;
+    long v = 0;
+    while (*q < rp->end && **q >= '0' && **q <= '9') {
+        v = v * 10 + (**q - '0');
+        if (v > REGEX_MAX_REPEAT)
+            v = REGEX_MAX_REPEAT + 1;
+        (*q)++;
+    }
+    *value = (int)v;
+    return *q > s;
+}
+
+// {m}, {m,} or {m,n} at rp->p. A brace that doesn't start one of these is
+// an ordinary character, as in most engines.
+static bool parse_braces(RegexParser* rp, int* min, int* max)
+{
+    const unsigned char* q = rp->p + 1;
+    if (!parse_count(rp, &q, min))
+        return false;
+    *max = *min;
+    if (q < rp->end && *q == ',') {
+        q++;
+        if (!parse_count(rp, &q, max))
+            *max = -1;
+    }
+    if (q == rp->end || *q != '}')
+        return false;
+    rp->p = q + 1;
+    if (*min > REGEX_MAX_REPEAT || *max > REGEX_MAX_REPEAT)
+        rp->error = "repetition count too large";
+    else if (*max >= 0 && *max < *min)
+        rp->error = "bad repetition range";
+    return true;
+}
+
+static int parse_repeat(RegexParser* rp)
+{
+    unsigned char c = *rp->p;
+    if (c == '*' || c == '+' || c == '?') {
+        rp->error = "nothing to repeat";
+        return -1;
+    }
+    int atom = parse_atom(rp);
+    while (atom >= 0 && rp->p < rp->end) {
+        int min, max;
+        c = *rp->p;
+        if (c == '*' || c == '+' || c == '?') {
+            rp->p++;
+            min = c == '+' ? 1 : 0;
+            max = c == '?' ? 1 : -1;
+        } else if (c != '{' || !parse_braces(rp, &min, &max)) {
+            break;
+        }
+        if (!rp->error.empty())
+            return -1;
+        bool greedy = true;
+        if (rp->p < rp->end && *rp->p == '?') {
+            greedy = false;
+            rp->p++;
+        }
+        int r = node_new(rp, NODE_REPEAT);
+        rp->nodes[r].kids.push_back(atom);
+        rp->nodes[r].min = min;
+        rp->nodes[r].max = max;
+        rp->nodes[r].greedy = greedy;
+        atom = r;
+    }
+    return atom;
+}
+
+static int parse_concat(RegexParser* rp)
+{
+    int cat = node_new(rp, NODE_CONCAT);
+    while (rp->p < rp->end && *rp->p != '|' && *rp->p != ')') {
+        int n = parse_repeat(rp);
+        if (n < 0)
+            return -1;
+        rp->nodes[cat].kids.push_back(n);
+    }
+    return cat;
+}
+
+static int parse_alt(RegexParser* rp)
+{
+    int first = parse_concat(rp);
+    if (first < 0 || rp->p == rp->end || *rp->p != '|')
+        return first;
+    int alt = node_new(rp, NODE_ALT);
+    rp->nodes[alt].kids.push_back(first);
+    while (rp->p < rp->end && *rp->p == '|') {
+        rp->p++;
+        int n = parse_concat(rp);
+        if (n < 0)
+            return -1;
+        rp->nodes[alt].kids.push_back(n);
+    }
+    return alt;
+}
+
+//
+// NFA
+//
+
+enum {
+    NFA_BYTES,     // consume a byte of sets[set], go to out
+    NFA_SPLIT,     // go to out, or else to out1
+    NFA_PREV_NL,   // go to out if the byte before is '\n' or there is none
+    NFA_NEXT_NL,   // go to out if the byte after is '\n' or there is none
+    NFA_RESTART,   // consume any byte, go to out; the match hasn't begun
+    NFA_MATCH
+};
+
+// "Before" and "after" are in scan direction: the reversed program reads
+// the text backwards, so ^ and $ trade places in it.
+struct NfaState {
+    unsigned char op;
+    int out;
+    int out1;
+    int set;
+};
+
+struct RegexProgram {
+    std::vector<NfaState> states;
+    std::vector<ByteSet> sets;
+    int start;
+    bool has_prev_nl;       // DFA states then depend on the byte before
+    unsigned char byte_class[256];
+    int classes;
+};
+
+static int nfa_add(RegexProgram* prog, int op, int out, int out1 = -1, int set = -1)
+{
+    NfaState st = { (unsigned char)op, out, out1, set };
+    prog->states.push_back(st);
+    return (int)prog->states.size() - 1;
+}
+
+// Compile node n to run before the states from next on; returns its entry.
+// Built back to front, so every state's successors already exist.
+static int compile(RegexProgram* prog, const std::vector<RegexNode>& nodes, int n, int next,
+                   bool reverse)
+{
+    if (prog->states.size() > REGEX_MAX_STATES)
+        return next;
+    const RegexNode& node = nodes[n];
+    switch (node.kind) {
+    case NODE_BYTES:
+        prog->sets.push_back(node.set);
+        return nfa_add(prog, NFA_BYTES, next, -1, (int)prog->sets.size() - 1);
+    case NODE_CONCAT:
+        if (reverse) {
+            for (size_t i = 0; i < node.kids.size(); i++)
+                next = compile(prog, nodes, node.kids[i], next, reverse);
+        } else {
+            for (size_t i = node.kids.size(); i-- > 0; )
+                next = compile(prog, nodes, node.kids[i], next, reverse);
+        }
+        return next;
+    case NODE_ALT: {
+        int alt = compile(prog, nodes, node.kids.back(), next, reverse);
+        for (size_t i = node.kids.size() - 1; i-- > 0; )
+            alt = nfa_add(prog, NFA_SPLIT, compile(prog, nodes, node.kids[i], next, reverse), alt);
+        return alt;
+    }
+    case NODE_REPEAT: {
+        int kid = node.kids[0];
+        if (node.max < 0) {
+            int loop = nfa_add(prog, NFA_SPLIT, -1, -1);
+            int body = compile(prog, nodes, kid, loop, reverse);
+            prog->states[loop].out = node.greedy ? body : next;
+            prog->states[loop].out1 = node.greedy ? next : body;
+            next = loop;
+        } else {
+            // x{0,3} as (x(x(x)?)?)?
+            int tail = next;
+            for (int i = node.min; i < node.max; i++) {
+                int body = compile(prog, nodes, kid, next, reverse);
+                next = node.greedy ? nfa_add(prog, NFA_SPLIT, body, tail)
+                                   : nfa_add(prog, NFA_SPLIT, tail, body);
+            }
+        }
+        for (int i = 0; i < node.min; i++)
+            next = compile(prog, nodes, kid, next, reverse);
+        return next;
+    }
+    case NODE_LINE_START:
+        return nfa_add(prog, reverse ? NFA_NEXT_NL : NFA_PREV_NL, next);
+    case NODE_LINE_END:
+        return nfa_add(prog, reverse ? NFA_PREV_NL : NFA_NEXT_NL, next);
+    }
+    return next;
+}
+
+static RegexProgram* program_new(const std::vector<RegexNode>& nodes, int root, bool reverse,
+                                 bool unanchored)
+{
+    RegexProgram* prog = new RegexProgram;
+    int match = nfa_add(prog, NFA_MATCH, -1);
+    prog->start = compile(prog, nodes, root, match, reverse);
+    if (unanchored) {
+        // A lazy .* in front, as the lowest priority thread: trying again a
+        // byte later, until a match has been found
+        int loop = nfa_add(prog, NFA_SPLIT, prog->start, -1);
+        prog->states[loop].out1 = nfa_add(prog, NFA_RESTART, loop);
+        prog->start = loop;
+    }
+    prog->has_prev_nl = false;
+    for (size_t i = 0; i < prog->states.size(); i++) {
+        if (prog->states[i].op == NFA_PREV_NL)
+            prog->has_prev_nl = true;
+    }
+
+    // Bytes no set tells apart share a column of the transition table.
+    // '\n' always gets its own, as ^ and $ look for it.
+    bool edge[256] = { false };
+    edge['\n'] = edge['\n' + 1] = true;
+    for (size_t i = 0; i < prog->sets.size(); i++) {
+        const ByteSet& set = prog->sets[i];
+        for (int b = 1; b < 256; b++) {
+            if (set[b] != set[b - 1])
+                edge[b] = true;
+        }
+    }
+    int c = 0;
+    for (int b = 0; b < 256; b++) {
+        if (b > 0 && edge[b])
+            c++;
+        prog->byte_class[b] = (unsigned char)c;
+    }
+    prog->classes = c + 1;
+    return prog;
+}
+
+//
+// Lazy DFA
+//
+
+#define DFA_DEAD 0
+// Match flags of a DFA state: a match ends here whatever comes next, or
+// only if the next byte is '\n' or there is none (a pending $)
+#define MATCH_NOW 1
+#define MATCH_AT_NL 2
+
+// A DFA state is the ordered list of NFA threads alive, highest priority
+// first. A thread is an NFA state times 2, plus 1 once it has consumed a
+// byte: only those can match, so matches are never empty.
+struct RegexDfa {
+    const RegexProgram* prog;
+    bool longest;      // keep lower-priority threads after a match instead of cutting them
+
+    std::vector<size_t> first;          // by state: its threads in the pool
+    std::vector<int> count;
+    std::vector<unsigned char> prev_nl;
+    std::vector<unsigned char> match;
+    std::vector<int> pool;
+    std::vector<int> next;              // states x classes, -1 until worked out
+    std::unordered_map<std::string, int> index;
+    size_t max_states;
+    size_t max_pool;
+    int starts[2];                      // by prev_nl, -1 until made
+    unsigned int flushes;
+
+    // scratch
+    std::vector<int> cur, resolved, out, probe, stack;
+    std::vector<unsigned int> mark;
+    unsigned int gen;
+    std::string key;
+};
+
+static void dfa_reset(RegexDfa* d)
+{
+    d->first.clear();
+    d->count.clear();
+    d->prev_nl.clear();
+    d->match.clear();
+    d->pool.clear();
+    d->next.clear();
+    d->index.clear();
+    d->starts[0] = d->starts[1] = -1;
+    // the dead state: no threads, nothing changes it
+    d->first.push_back(0);
+    d->count.push_back(0);
+    d->prev_nl.push_back(0);
+    d->match.push_back(0);
+    d->next.assign(d->prog->classes, DFA_DEAD);
+}
+
+static RegexDfa* dfa_new(const RegexProgram* prog, bool longest)
+{
+    RegexDfa* d = new RegexDfa;
+    d->prog = prog;
+    d->longest = longest;
+    size_t per_state = prog->classes * sizeof(int) + sizeof(size_t) + sizeof(int) + 2 + 64;
+    d->max_states = std::max((size_t)64, REGEX_CACHE_BYTES / per_state);
+    d->max_pool = REGEX_CACHE_BYTES / sizeof(int);
+    d->flushes = 0;
+    d->mark.assign(prog->states.size() * 2, 0);
+    d->gen = 0;
+    dfa_reset(d);
+    return d;
+}
+
+static void dfa_next_gen(RegexDfa* d)
+{
+    if (++d->gen == 0) {
+        std::fill(d->mark.begin(), d->mark.end(), 0);
+        d->gen = 1;
+    }
+}
+
+// Append the threads reachable from thread t without consuming a byte, in
+// priority order; next_nl if the next byte is known to be '\n' or the end.
+// In leftmost-first mode a match cuts off everything after it, which *cut
+// reports.
+static void dfa_closure(RegexDfa* d, std::vector<int>* out, int t, bool prev_nl, bool next_nl,
+                        bool* cut)
+{
+    const NfaState* states = &d->prog->states[0];
+    d->stack.clear();
+    d->stack.push_back(t);
+    while (!d->stack.empty()) {
+        t = d->stack.back();
+        d->stack.pop_back();
+        if (d->mark[t] == d->gen)
+            continue;
+        d->mark[t] = d->gen;
+        const NfaState& st = states[t >> 1];
+        int consumed = t & 1;
+        switch (st.op) {
+        case NFA_SPLIT:
+            d->stack.push_back(st.out1 * 2 + consumed);
+            d->stack.push_back(st.out * 2 + consumed);
+            break;
+        case NFA_PREV_NL:
+            if (prev_nl)
+                d->stack.push_back(st.out * 2 + consumed);
+            break;
+        case NFA_NEXT_NL:
+            if (next_nl)
+                d->stack.push_back(st.out * 2 + consumed);
+            else
+                out->push_back(t);
+            break;
+        case NFA_MATCH:
+            if (!consumed)
+                break;
+            out->push_back(t);
+            if (!d->longest) {
+                *cut = true;
+                return;
+            }
+            break;
+        default:
+            out->push_back(t);
+            break;
+        }
+    }
+}
+
+// The threads of src once the next byte is known to be '\n' (or the end):
+// pending $ assertions pass
+static void dfa_resolve_nl(RegexDfa* d, const std::vector<int>& src, bool prev_nl,
+                           std::vector<int>* out)
+{
+    const NfaState* states = &d->prog->states[0];
+    dfa_next_gen(d);
+    bool cut = false;
+    for (size_t i = 0; i < src.size() && !cut; i++) {
+        int t = src[i];
+        const NfaState& st = states[t >> 1];
+        if (st.op == NFA_NEXT_NL) {
+            dfa_closure(d, out, st.out * 2 + (t & 1), prev_nl, true, &cut);
+        } else if (d->mark[t] != d->gen) {
+            d->mark[t] = d->gen;
+            out->push_back(t);
+            cut = st.op == NFA_MATCH && !d->longest;
+        }
+    }
+}
+
+static int dfa_intern(RegexDfa* d, const std::vector<int>& list, bool prev_nl)
+{
+    if (list.empty())
+        return DFA_DEAD;
+    if (!d->prog->has_prev_nl)
+        prev_nl = false;
+    d->key.assign((const char*)&list[0], list.size() * sizeof(int));
+    d->key.push_back((char)prev_nl);
+    std::unordered_map<std::string, int>::iterator it = d->index.find(d->key);
+    if (it != d->index.end())
+        return it->second;
+
+    if (d->first.size() >= d->max_states || d->pool.size() + list.size() > d->max_pool) {
+        dfa_reset(d);
+        d->flushes++;
+    }
+
+    const NfaState* states = &d->prog->states[0];
+    unsigned char match = 0;
+    for (size_t i = 0; i < list.size(); i++) {
+        if (states[list[i] >> 1].op == NFA_MATCH)
+            match = MATCH_NOW | MATCH_AT_NL;
+    }
+    if (!match) {
+        d->probe.clear();
+        dfa_resolve_nl(d, list, prev_nl, &d->probe);
+        for (size_t i = 0; i < d->probe.size(); i++) {
+            if (states[d->probe[i] >> 1].op == NFA_MATCH)
+                match = MATCH_AT_NL;
+        }
+    }
+
+    int id = (int)d->first.size();
+    d->first.push_back(d->pool.size());
+    d->count.push_back((int)list.size());
+    d->prev_nl.push_back(prev_nl);
+    d->match.push_back(match);
+    d->pool.insert(d->pool.end(), list.begin(), list.end());
+    d->next.resize(d->next.size() + d->prog->classes, -1);
+    d->index[d->key] = id;
+    return id;
+}
+
+static int dfa_start(RegexDfa* d, bool prev_nl)
+{
+    if (!d->prog->has_prev_nl)
+        prev_nl = false;
+    if (d->starts[prev_nl] >= 0)
+        return d->starts[prev_nl];
+    dfa_next_gen(d);
+    d->out.clear();
+    bool cut = false;
+    dfa_closure(d, &d->out, d->prog->start * 2, prev_nl, false, &cut);
+    int id = dfa_intern(d, d->out, prev_nl);
+    d->starts[prev_nl] = id;
+    return id;
+}
+
+// Work out and cache the transition of state s on byte b
+static int dfa_step(RegexDfa* d, int s, unsigned char b)
+{
+    const NfaState* states = &d->prog->states[0];
+    d->cur.assign(d->pool.begin() + d->first[s], d->pool.begin() + d->first[s] + d->count[s]);
+    bool nl = b == '\n';
+    const std::vector<int>* src = &d->cur;
+    if (nl) {
+        d->resolved.clear();
+        dfa_resolve_nl(d, d->cur, d->prev_nl[s], &d->resolved);
+        src = &d->resolved;
+    }
+
+    dfa_next_gen(d);
+    d->out.clear();
+    bool cut = false;
+    for (size_t i = 0; i < src->size() && !cut; i++) {
+        const NfaState& st = states[(*src)[i] >> 1];
+        if (st.op == NFA_MATCH) {
+            cut = !d->longest;
+        } else if (st.op == NFA_BYTES && d->prog->sets[st.set][b]) {
+            dfa_closure(d, &d->out, st.out * 2 + 1, nl, false, &cut);
+        } else if (st.op == NFA_RESTART) {
+            dfa_closure(d, &d->out, st.out * 2, nl, false, &cut);
+        }
+    }
+
+    unsigned int flushes = d->flushes;
+    int id = dfa_intern(d, d->out, nl);
+    if (d->flushes == flushes) {
+        d->next[(size_t)s * d->prog->classes + d->prog->byte_class[b]] = id;
+    } else {
+        // s is gone with the rest of the cache; the start states are
+        // wanted straight away by find()'s skipping
+        dfa_start(d, false);
+    }
+    return id;
+}
+
+static inline int dfa_next(RegexDfa* d, int s, unsigned char b)
+{
+    int t = d->next[(size_t)s * d->prog->classes + d->prog->byte_class[b]];
+    return t >= 0 ? t : dfa_step(d, s, b);
+}
+
+//
+// Searching
+//
+
+// Index of the span holding byte pos
+static size_t span_index(const TextSnapshot* text, size_t pos)
+{
+    return std::upper_bound(text->starts.begin(), text->starts.end(), pos) - text->starts.begin() - 1;
+}
+
+static unsigned char text_byte(const TextSnapshot* text, size_t pos)
+{
+    size_t k = span_index(text, pos);
+    return text->spans[k].data[pos - text->starts[k]];
+}
+
+RegexSearch::RegexSearch(const char* pattern, size_t len, bool match_case)
+{
+    forward = reverse = NULL;
+    forward_dfa = reverse_dfa = NULL;
+    skip = NULL;
+    poll = NULL;
+    poll_arg = NULL;
+    unpolled = 0;
+    was_cancelled = false;
+
+    RegexParser rp;
+    rp.p = (const unsigned char*)pattern;
+    rp.end = rp.p + len;
+    rp.match_case = match_case;
+    rp.depth = 0;
+    int root = parse_alt(&rp);
+    if (root >= 0 && rp.p < rp.end)
+        rp.error = "unmatched )";
+    if (!rp.error.empty()) {
+        message = rp.error;
+        return;
+    }
+
+    forward = program_new(rp.nodes, root, false, true);
+    reverse = program_new(rp.nodes, root, true, false);
+    if (forward->states.size() > REGEX_MAX_STATES || reverse->states.size() > REGEX_MAX_STATES) {
+        message = "pattern is too large";
+        return;
+    }
+    forward_dfa = dfa_new(forward, false);
+    reverse_dfa = dfa_new(reverse, true);
+    setup_skip();
+}
+
+RegexSearch::~RegexSearch()
+{
+    delete forward_dfa;
+    delete reverse_dfa;
+    delete forward;
+    delete reverse;
+    delete skip;
+}
+
+// Most bytes of most texts leave the forward DFA in its start state. If
+// only one byte (or one letter in either case) can take it anywhere else,
+// the literal search finds the next one far faster than stepping through.
+void RegexSearch::setup_skip()
+{
+    int idle = dfa_start(forward_dfa, false);
+    unsigned char bytes[2];
+    int n = 0;
+    for (int b = 0; b < 256 && n <= 2; b++) {
+        if (dfa_next(forward_dfa, idle, (unsigned char)b) != idle) {
+            if (n < 2)
+                bytes[n] = (unsigned char)b;
+            n++;
+        }
+    }
+    if (n == 1)
+        skip = new TextSearch((const char*)bytes, 1, true);
+    else if (n == 2 && (bytes[0] | 0x20) == bytes[1] && bytes[1] >= 'a' && bytes[1] <= 'z')
+        skip = new TextSearch((const char*)&bytes[1], 1, false);
+}
+
+void RegexSearch::set_poll(bool (*func)(size_t pos, void* arg), void* arg)
+{
+    poll = func;
+    poll_arg = arg;
+    unpolled = 0;
+}
+
+// Count bytes scanned, calling the poll function once enough have been.
+// Scans are counted across calls to find(), as a search for many short
+// matches takes as long as one for a long match.
+bool RegexSearch::tick(size_t pos, size_t bytes)
+{
+    unpolled += bytes;
+    if (unpolled < REGEX_POLL_BYTES || !poll)
+        return true;
+    unpolled = 0;
+    if (poll(pos, poll_arg))
+        return true;
+    was_cancelled = true;
+    return false;
+}
+
+// Run the forward DFA from "from" until it dies or the text ends. Returns
+// 1 with the end of the leftmost-first match, 0 if there is none, -1 if
+// the poll function gave up.
+int RegexSearch::scan_end(const TextSnapshot* text, size_t from, size_t* end)
+{
+    RegexDfa* d = forward_dfa;
+    bool prev_nl = from == 0 || text_byte(text, from - 1) == '\n';
+    int s = dfa_start(d, prev_nl);
+    bool found = false;
+    size_t last = 0;
+
+    for (size_t k = span_index(text, from); k < text->spans.size(); k++) {
+        const unsigned char* data = (const unsigned char*)text->spans[k].data;
+        size_t len = text->spans[k].len;
+        size_t base = text->starts[k];
+        size_t i = from > base ? from - base : 0;
+        size_t scanned = i;
+        while (i < len) {
+            if (skip && s == d->starts[0]) {
+                const char* hit = skip->find((const char*)data + i, len - i);
+                if (!hit)
+                    break;
+                i = (const unsigned char*)hit - data;
+            }
+            unsigned char m = d->match[s];
+            if (m && ((m & MATCH_NOW) || data[i] == '\n')) {
+                found = true;
+                last = base + i;
+            }
+            s = dfa_next(d, s, data[i++]);
+            if (s == DFA_DEAD) {
+                *end = last;
+                return tick(base + i, i - scanned) ? found : -1;
+            }
+        }
+        if (!tick(base + len, len - scanned))
+            return -1;
+    }
+    if (d->match[s]) {
+        found = true;
+        last = text->length;
+    }
+    *end = last;
+    return found;
+}
+
+// Run the reversed pattern's DFA back from the end of a match to find
+// where it starts: the earliest start at or after "from" of a match ending
+// at end, which for the match the forward scan found is its own.
+size_t RegexSearch::scan_start(const TextSnapshot* text, size_t from, size_t end)
+{
+    RegexDfa* d = reverse_dfa;
+    bool prev_nl = end >= text->length || text_byte(text, end) == '\n';
+    int s = dfa_start(d, prev_nl);
+    size_t best = end;
+    size_t i = end;
+
+    for (size_t k = span_index(text, end - 1); ; k--) {
+        const unsigned char* data = (const unsigned char*)text->spans[k].data;
+        size_t j = i - text->starts[k];   // bytes of span k before i
+        size_t scanned = i;
+        while (j > 0 && i > from) {
+            s = dfa_next(d, s, data[--j]);
+            i--;
+            if (s == DFA_DEAD) {
+                tick(i, scanned - i);
+                return best;
+            }
+            unsigned char m = d->match[s];
+            if (m) {
+                bool nl = i == 0 || (j > 0 ? data[j - 1] : text_byte(text, i - 1)) == '\n';
+                if ((m & MATCH_NOW) || nl)
+                    best = i;
+            }
+        }
+        if (!tick(i, scanned - i) || i == from || k == 0)
+            break;
+    }
+    return best;
+}
+
+bool RegexSearch::find(const TextSnapshot* text, size_t from, size_t* start, size_t* end)
+{
+    was_cancelled = false;
+    if (!forward_dfa || from >= text->length)
+        return false;
+    size_t e;
+    if (scan_end(text, from, &e) <= 0 || was_cancelled)
+        return false;
+    size_t s = scan_start(text, from, e);
+    if (was_cancelled)
+        return false;
+    *start = s;
+    *end = e;
+    return true;
+}
+
+bool RegexSearch::find_forward(const PieceTable* pieces, size_t from, size_t* start, size_t* end)
+{
+    TextSnapshot text;
+    text_snapshot(pieces, &text);
+    return find(&text, from, start, end);
+}
@@ -0,0 +1,66 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#ifndef REGEX_SEARCH_H
+#define REGEX_SEARCH_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "text_search.h"
+
+struct RegexProgram;
+struct RegexDfa;
+
+// Regular expression search without backtracking. The pattern is compiled
+// once into an NFA, which is turned into a DFA lazily, a state at a time,
+// as the text needs it; time is linear in the bytes scanned whatever the
+// pattern. Matches are leftmost-first, as in Perl: the forward DFA finds
+// where the match ends, and a DFA of the reversed pattern run back from
+// there finds where it starts.
+//
+// Syntax: literals, ".", [classes] with ranges and negation, \d \w \s and
+// their negations, groups (with or without ?:), "|", the quantifiers * + ?
+// {m} {m,} {m,n} and their lazy forms, and ^ and $ at line boundaries.
+// There are no captures or backreferences. Without match_case, letters
+// match either case, by the same folding as TextSearch.
+class RegexSearch {
+public:
+    RegexSearch(const char* pattern, size_t len, bool match_case);
+    ~RegexSearch();
+
+    // NULL if the pattern compiled, otherwise what is wrong with it
+    const char* error() const { return message.empty() ? NULL : message.c_str(); }
+
+    // Called every so often while scanning with the offset reached; return
+    // false to give up, making the search fail with cancelled() set.
+    void set_poll(bool (*func)(size_t pos, void* arg), void* arg);
+    bool cancelled() const { return was_cancelled; }
+
+    // First non-empty match starting at or after from, in *start and *end
+    bool find(const TextSnapshot* text, size_t from, size_t* start, size_t* end);
+    bool find_forward(const PieceTable* pieces, size_t from, size_t* start, size_t* end);
+
+private:
+    std::string message;
+    RegexProgram* forward;
+    RegexProgram* reverse;
+    RegexDfa* forward_dfa;   // unanchored, leftmost-first
+    RegexDfa* reverse_dfa;   // anchored at the match end, longest
+    TextSearch* skip;        // finds the bytes that can start a match, if few
+    bool (*poll)(size_t pos, void* arg);
+    void* poll_arg;
+    size_t unpolled;         // bytes scanned since poll was last called
+    bool was_cancelled;
+
+    int scan_end(const TextSnapshot* text, size_t from, size_t* end);
+    size_t scan_start(const TextSnapshot* text, size_t from, size_t end);
+    void setup_skip();
+    bool tick(size_t pos, size_t bytes);
+
+    RegexSearch(const RegexSearch&);
+    RegexSearch& operator=(const RegexSearch&);
+};
+
+#endif // REGEX_SEARCH_H
@@ -0,0 +1,527 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#include "search_fltk.h"
+#include "window_fltk.h"
+#include "piece_table.h"
+#include "text_search.h"
+#include "regex_search.h"
+#include "highlight_fltk.h"
+#include "file_fltk.h"
+#include "watch_fltk.h"
+#include <FL/Fl.H>
+#include <FL/Fl_Window.H>
+#include <FL/Fl_Input.H>
+#include <FL/Fl_Check_Button.H>
+#include <FL/Fl_Return_Button.H>
+#include <FL/Fl_Progress.H>
+#include <FL/fl_ask.H>
+#include <algorithm>
+#include <vector>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+// Seconds a regular expression search runs before showing its progress
+#define SEARCH_PROGRESS_DELAY 0.3
+
+// Shared by every window, like the GTK version's
+static char* string_find = NULL;
+static char* string_replace = NULL;
+static bool match_case = false;
+static bool replace_all = false;
+static bool use_regex = false;
+static RegexSearch* regex = NULL;   // string_find compiled, in regex mode
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// A regular expression search can take a while on a big document. Once it
+// has run for SEARCH_PROGRESS_DELAY a modal window shows how far it got
+// and lets it be cancelled. Being modal, it keeps the user from editing
+// the document under the search; the loader and the file watch, which
+// change it from callbacks the event loop would run, are paused until the
+// search is over.
+struct SearchProgress {
+    MainWindow* window;
+    double started;
+    size_t total;
+    Fl_Window* dialog;
+    Fl_Progress* bar;
+    Fl_Button* cancel;
+};
+
+static bool search_progress_poll(size_t pos, void* arg)
+{
+    SearchProgress* sp = (SearchProgress*)arg;
+    if (!sp->dialog) {
+        if (now_seconds() - sp->started < SEARCH_PROGRESS_DELAY)
+            return true;
+        sp->dialog = new Fl_Window(300, 75, "Searching");
+        sp->bar = new Fl_Progress(10, 10, 280, 20);
+        sp->bar->minimum(0);
+        sp->bar->maximum(100);
+        sp->cancel = new Fl_Button(205, 40, 85, 25, "Cancel");
+        sp->dialog->end();
+        sp->dialog->set_modal();
+        sp->dialog->show();
+        file_open_pause(sp->window, true);
+        file_watch_pause(sp->window, true);
+    }
+    int percent = sp->total ? (int)(std::min(pos, sp->total) * 100 / sp->total) : 100;
+    char label[32];
+    snprintf(label, sizeof(label), "%d%%", percent);
+    sp->bar->value((float)percent);
+    sp->bar->copy_label(label);
+    Fl::check();
+    Fl_Widget* o;
+    while ((o = Fl::readqueue())) {
+        if (o == sp->cancel || o == sp->dialog)
+            return false;
+    }
+    return sp->dialog->shown();
+}
+
+static void search_progress_begin(SearchProgress* sp, MainWindow* window, size_t total)
+{
+    sp->window = window;
+    sp->started = now_seconds();
+    sp->total = total;
+    sp->dialog = NULL;
+    regex->set_poll(search_progress_poll, sp);
+}
+
+static void search_progress_end(SearchProgress* sp)
+{
+    regex->set_poll(NULL, NULL);
+    if (!sp->dialog)
+        return;
+    delete sp->dialog;
+    file_watch_pause(sp->window, false);
+    file_open_pause(sp->window, false);
+}
+
+// The next match at or after from, of the string or the regular
+// expression. False also if the search was cancelled. Once the highlighter
+// has found every match of the string, it is looked up there instead, so
+// the jump lands on a highlighted match.
+static bool find_match(MainWindow* window, size_t from, size_t* start, size_t* end)
+{
+    PieceTable* pieces = window->pieces;
+    MatchHighlighter* index = window->highlighter;
+    if (!use_regex && index->complete()) {
+        if (!index->next_match(from, start))
+            return false;
+        *end = *start + index->length();
+        return true;
+    }
+    if (use_regex) {
+        SearchProgress progress;
+        search_progress_begin(&progress, window, pieces->length());
+        bool found = regex->find_forward(pieces, from, start, end);
+        search_progress_end(&progress);
+        return found;
+    }
+    TextSearch search(string_find, strlen(string_find), match_case);
+    if (!search.find_forward(pieces, from, pieces->length(), start))
+        return false;
+    *end = *start + search.length();
+    return true;
+}
+
+// The last match ending at or before to. A regular expression can only be
+// run forwards, so it is searched for from the start of the document.
+static bool find_match_backward(MainWindow* window, size_t to, size_t* start, size_t* end)
+{
+    PieceTable* pieces = window->pieces;
+    MatchHighlighter* index = window->highlighter;
+    if (!use_regex && index->complete()) {
+        if (!index->previous_match(to, start))
+            return false;
+        *end = *start + index->length();
+        return true;
+    }
+    if (use_regex) {
+        TextSnapshot text;
+        text_snapshot(pieces, &text);
+        SearchProgress progress;
+        search_progress_begin(&progress, window, to);
+        size_t from = 0, s, e;
+        bool found = false;
+        while (from < to && regex->find(&text, from, &s, &e) && e <= to) {
+            *start = s;
+            *end = e;
+            found = true;
+            from = e;
+        }
+        search_progress_end(&progress);
+        return found && !regex->cancelled();
+    }
+    TextSearch search(string_find, strlen(string_find), match_case);
+    if (!search.find_backward(pieces, 0, to, start))
+        return false;
+    *end = *start + search.length();
+    return true;
+}
+
+// Search from the cursor, or from the selection, and select the match.
+// Searching runs over the piece table's bytes, not through the
+// Fl_Text_Buffer. Like the GTK version, a forward search leaves the cursor
+// after the match and a backward one before it.
+static bool document_search_real(MainWindow* window, bool forward)
+{
+    EditorView* editor = window->editor;
+    int sel_start, sel_end;
+    if (!editor->buffer()->selection_position(&sel_start, &sel_end))
+        sel_start = sel_end = editor->insert_position();
+    size_t match, end;
+    bool found = forward ? find_match(window, sel_end, &match, &end)
+                         : find_match_backward(window, sel_start, &match, &end);
+    if (!found) {
+        if (!use_regex || !regex->cancelled())
+            fl_message("Search string not found");
+        return false;
+    }
+    editor->buffer()->select((int)match, (int)end);
+    editor->insert_position((int)(forward ? end : match));
+    editor->show_insert_position();
+    window->highlighter->selection_moved();
+    return true;
+}
+
+// Modal dialog asking for the search string, and with replace for what to
+// put in its place; false if it was cancelled. A regular expression has to
+// compile before the dialog is accepted.
+static bool run_dialog_find(bool replace)
+{
+    int extra = replace ? 60 : 0;
+    Fl_Window* dialog = new Fl_Window(360, 130 + extra, replace ? "Replace" : "Find");
+    Fl_Input* entry = new Fl_Input(100, 10, 250, 25, replace ? "Find what:" : "Search for:");
+    entry->value(string_find ? string_find : "");
+    Fl_Input* replace_entry = NULL;
+    if (replace) {
+        replace_entry = new Fl_Input(100, 40, 250, 25, "Replace with:");
+        replace_entry->value(string_replace ? string_replace : "");
+    }
+    Fl_Check_Button* case_button = new Fl_Check_Button(100, 40 + extra / 2, 250, 25, "Match case");
+    case_button->value(match_case);
+    Fl_Check_Button* regex_button = new Fl_Check_Button(100, 65 + extra / 2, 250, 25,
+                                                        "Regular expression");
+    regex_button->value(use_regex);
+    Fl_Check_Button* all_button = NULL;
+    if (replace) {
+        all_button = new Fl_Check_Button(100, 125, 250, 25, "Replace all at once");
+        all_button->value(replace_all);
+    }
+    Fl_Button* cancel = new Fl_Button(170, 95 + extra, 85, 25, "Cancel");
+    Fl_Return_Button* find = new Fl_Return_Button(265, 95 + extra, 85, 25,
+                                                  replace ? "Replace" : "Find");
+    dialog->end();
+    dialog->set_modal();
+    dialog->show();
+
+    bool accepted = false;
+    RegexSearch* compiled = NULL;
+    while (dialog->shown()) {
+        Fl::wait();
+        Fl_Widget* o;
+        while ((o = Fl::readqueue())) {
+            if (o == find) {
+                if (entry->size() == 0) {
+                    fl_beep();
+                    continue;
+                }
+                if (regex_button->value()) {
+                    delete compiled;
+                    compiled = new RegexSearch(entry->value(), entry->size(),
+                                               case_button->value() != 0);
+                    if (compiled->error()) {
+                        fl_alert("Invalid regular expression: %s", compiled->error());
+                        continue;
+                    }
+                }
+                accepted = true;
+                dialog->hide();
+            } else if (o == cancel || o == dialog) {
+                dialog->hide();
+            }
+        }
+    }
+    if (accepted) {
+        free(string_find);
+        string_find = strdup(entry->value());
+        match_case = case_button->value() != 0;
+        use_regex = compiled != NULL;
+        delete regex;
+        regex = compiled;
+        compiled = NULL;
+        if (replace) {
+            free(string_replace);
+            string_replace = strdup(replace_entry->value());
+            replace_all = all_button->value() != 0;
+        }
+    }
+    delete compiled;
+    delete dialog;
+    return accepted;
+}
+
+// Highlight the matches of the search string. Regular expression matches
+// aren't highlighted, and any earlier highlighting goes.
+static void highlight_matches(MainWindow* window)
+{
+    if (use_regex)
+        window->highlighter->clear();
+    else
+        window->highlighter->start(string_find, strlen(string_find), match_case);
+}
+
+void run_dialog_search(MainWindow* window)
+{
+    if (file_open_in_progress(window))
+        return;
+    if (run_dialog_find(false)) {
+        highlight_matches(window);
+        document_search_real(window, true);
+    }
+}
+
+static void search_again(MainWindow* window, bool forward)
+{
+    if (!string_find) {
+        run_dialog_search(window);
+        return;
+    }
+    document_search_real(window, forward);
+}
+
+void search_find_next(MainWindow* window)
+{
+    search_again(window, true);
+}
+
+void search_find_previous(MainWindow* window)
+{
+    search_again(window, false);
+}
+
+// The text of a stretch with every match replaced, built while walking its
+// segments once
+struct ReplaceBuild {
+    const std::vector<size_t>* starts;
+    const std::vector<size_t>* ends;
+    size_t next;            // index of the next match
+    const char* replacement;
+    size_t rlen;
+    size_t pos;             // document offset of the segment
+    size_t skip;            // bytes of the current match still to skip
+    char* out;
+};
+
+static bool build_segment(const char* data, size_t len, void* arg)
+{
+    ReplaceBuild* b = (ReplaceBuild*)arg;
+    size_t i = 0;
+    while (i < len) {
+        if (b->skip > 0) {
+            size_t n = std::min(b->skip, len - i);
+            b->skip -= n;
+            i += n;
+            continue;
+        }
+        size_t at = b->pos + i;
+        size_t m = b->next < b->starts->size() ? (*b->starts)[b->next] : (size_t)-1;
+        if (at == m) {
+            memcpy(b->out, b->replacement, b->rlen);
+            b->out += b->rlen;
+            b->skip = (*b->ends)[b->next] - m;
+            b->next++;
+            continue;
+        }
+        size_t n = std::min(m - at, len - i);
+        memcpy(b->out, data + i, n);
+        b->out += n;
+        i += n;
+    }
+    b->pos += len;
+    return true;
+}
+
+// Every match in the document, as start and end offsets. A string is
+// searched for by several threads; a regular expression is searched for
+// in one pass over a snapshot of the piece table, which the user may
+// cancel. False if they did.
+static bool find_all_matches(MainWindow* window, std::vector<size_t>* starts,
+                             std::vector<size_t>* ends)
+{
+    PieceTable* pieces = window->pieces;
+    if (!use_regex) {
+        TextSearch search(string_find, strlen(string_find), match_case);
+        search.find_all(pieces, starts);
+        ends->reserve(starts->size());
+        for (size_t i = 0; i < starts->size(); i++)
+            ends->push_back((*starts)[i] + search.length());
+        return true;
+    }
+
+    TextSnapshot text;
+    text_snapshot(pieces, &text);
+    SearchProgress progress;
+    search_progress_begin(&progress, window, text.length);
+    size_t from = 0, start, end;
+    while (regex->find(&text, from, &start, &end)) {
+        starts->push_back(start);
+        ends->push_back(end);
+        from = end;
+    }
+    search_progress_end(&progress);
+    return !regex->cancelled();
+}
+
+// Replace every match at once. The new text from the first match to the
+// end of the last is built in one pass, and it goes in with a single
+// replace(), which the undo manager records as one step holding the spans
+// of the old and the new text.
+static void document_replace_all(MainWindow* window)
+{
+    EditorView* editor = window->editor;
+    Fl_Text_Buffer* buffer = editor->buffer();
+    PieceTable* pieces = window->pieces;
+    size_t rlen = strlen(string_replace);
+
+    std::vector<size_t> starts, ends;
+    if (!find_all_matches(window, &starts, &ends))
+        return;
+    size_t n = starts.size();
+    if (n == 0) {
+        fl_message("Search string not found");
+        return;
+    }
+    size_t lo = starts.front();
+    size_t hi = ends.back();
+    size_t removed = 0;
+    for (size_t i = 0; i < n; i++)
+        removed += ends[i] - starts[i];
+    size_t new_len = hi - lo - removed + n * rlen;
+    if (pieces->length() - (hi - lo) + new_len > (size_t)INT_MAX) {
+        fl_alert("Replacing would make the document larger than 2 GB.");
+        return;
+    }
+    char* text = (char*)malloc(new_len + 1);
+    if (!text) {
+        fl_alert("Not enough memory to replace %lu strings.", (unsigned long)n);
+        return;
+    }
+    ReplaceBuild build = { &starts, &ends, 0, string_replace, rlen, lo, 0, text };
+    pieces->for_each_segment(lo, hi - lo, build_segment, &build);
+    *build.out = '\0';
+
+    // The cursor stays with the text it was in; inside a match it goes to
+    // the start of the replacement
+    size_t cursor = editor->insert_position();
+    size_t k = std::lower_bound(starts.begin(), starts.end(), cursor) - starts.begin();
+    if (k > 0 && ends[k - 1] > cursor)
+        cursor = starts[--k];
+    for (size_t i = 0; i < k; i++)
+        cursor -= ends[i] - starts[i];
+    cursor += k * rlen;
+
+    // The highlighting would only be worked out again to find nothing
+    window->highlighter->clear();
+    buffer->unselect();
+    buffer->replace((int)lo, (int)hi, text);
+    free(text);
+    editor->insert_position((int)cursor);
+    editor->show_insert_position();
+    fl_message("%lu strings replaced", (unsigned long)n);
+}
+
+// Select each match after the cursor in turn and ask whether to replace it.
+// Every replacement is an undo step of its own.
+static void document_replace_each(MainWindow* window)
+{
+    EditorView* editor = window->editor;
+    Fl_Text_Buffer* buffer = editor->buffer();
+    size_t rlen = strlen(string_replace);
+
+    highlight_matches(window);
+    size_t pos = editor->insert_position();
+    size_t match, end;
+    bool any = false;
+    while (find_match(window, pos, &match, &end)) {
+        any = true;
+        buffer->select((int)match, (int)end);
+        editor->insert_position((int)end);
+        editor->show_insert_position();
+        int answer = fl_choice("Replace?", "Cancel", "No", "Yes");
+        if (answer == 0)
+            break;
+        if (answer == 1) {
+            pos = end;
+            continue;
+        }
+        buffer->replace((int)match, (int)end, string_replace);
+        pos = match + rlen;
+        editor->insert_position((int)pos);
+    }
+    if (!any && !(use_regex && regex->cancelled()))
+        fl_message("Search string not found");
+}
+
+void run_dialog_replace(MainWindow* window)
+{
+    if (file_open_in_progress(window))
+        return;
+    if (!run_dialog_find(true))
+        return;
+    if (replace_all)
+        document_replace_all(window);
+    else
+        document_replace_each(window);
+}
+
+void run_dialog_jump_to(MainWindow* window)
+{
+    EditorView* editor = window->editor;
+    PieceTable* pieces = window->pieces;
+
+    char current[32];
+    snprintf(current, sizeof(current), "%lu",
+             (unsigned long)pieces->byte_to_line(editor->insert_position()) + 1);
+    const char* answer = fl_input("Line number (1 - %lu):", current,
+                                  (unsigned long)pieces->line_count());
+    if (!answer)
+        return;
+
+    char* end;
+    unsigned long line = strtoul(answer, &end, 10);
+    while (isspace((unsigned char)*end))
+        end++;
+    if (end == answer || *end || answer[0] == '-') {
+        fl_alert("\"%s\" is not a line number.", answer);
+        return;
+    }
+    // Like the spin button of the GTK dialog, clamp rather than complain.
+    // The count is re-read because a load may have added lines meanwhile.
+    unsigned long lines = pieces->line_count();
+    if (line < 1)
+        line = 1;
+    if (line > lines)
+        line = lines;
+
+    editor->insert_position((int)pieces->line_start(line - 1));
+    // Without wrapping, display lines are buffer lines, so the target can be
+    // put at the top of the view by number rather than by counting to it.
+    if (!window->line_wrap_enabled)
+        editor->scroll((int)line, 0);
+    editor->show_insert_position();
+    editor->take_focus();
+}
@@ -0,0 +1,25 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#ifndef SEARCH_FLTK_H
+#define SEARCH_FLTK_H
+
+class MainWindow;
+
+// Ask for a string and select its next occurrence after the cursor
+void run_dialog_search(MainWindow* window);
+// Search again for the last string; asks for one if there is none yet
+void search_find_next(MainWindow* window);
+// The same, searching backwards from the cursor
+void search_find_previous(MainWindow* window);
+// Ask for a string and its replacement, then replace either every match at
+// once or match by match, asking each time, like the GTK version
+void run_dialog_replace(MainWindow* window);
+
+// Ask for a line number and move the cursor to the start of that line.
+// The line is looked up in the piece table's line index, so the cost
+// doesn't grow with the size of the file.
+void run_dialog_jump_to(MainWindow* window);
+
+#endif // SEARCH_FLTK_H
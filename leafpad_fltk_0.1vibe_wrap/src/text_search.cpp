@@ -0,0 +1,610 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#include "text_search.h"
+#include "piece_table.h"
+#include "case_fold.h"
+#include <string.h>
+#include <algorithm>
+#include <bitset>
+#include <atomic>
+#include <thread>
+
+// Bytes of document one thread searches per step in find_all()
+#define TEXT_SEARCH_CHUNK (1024 * 1024)
+#define TEXT_SEARCH_MAX_THREADS 8
+// Bytes of document copied out and searched at a time by find_backward()
+#define TEXT_SEARCH_BACK_BLOCK (64 * 1024)
+// A byte of the pattern that isn't UTF-8 stands for itself: in the folded
+// pattern it is this plus its value, which no character folds to
+#define FOLD_RAW_BYTE 0x110000
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define TEXT_SEARCH_SIMD 1
+#include <immintrin.h>
+#endif
+
+static inline unsigned char ascii_lower(unsigned char c)
+{
+    return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+static inline bool ascii_letter(unsigned char c)
+{
+    c |= 0x20;
+    return c >= 'a' && c <= 'z';
+}
+
+TextSearch::TextSearch(const char* text, size_t len, bool case_sensitive)
+    : pattern(text, text + len), match_case(case_sensitive)
+{
+    fold_unicode = false;
+    if (!match_case) {
+        for (size_t i = 0; i < len; i++) {
+            pattern[i] = ascii_lower(pattern[i]);
+            if ((unsigned char)pattern[i] >= 0x80)
+                fold_unicode = true;
+        }
+    }
+    first_at = 0;
+    last_at = len > 0 ? len - 1 : 0;
+    first_byte = last_byte = first_or = last_or = 0;
+    back_shift.assign(256, len);
+    if (fold_unicode) {
+        setup_fold();
+    } else if (len > 0) {
+        first_byte = pattern[0];
+        last_byte = pattern[len - 1];
+        if (!match_case) {
+            first_or = ascii_letter(first_byte) ? 0x20 : 0;
+            last_or = ascii_letter(last_byte) ? 0x20 : 0;
+        }
+        for (size_t j = len; j-- > 1; ) {
+            unsigned char b = pattern[j];
+            back_shift[b] = j;
+            if (!match_case && ascii_letter(b))
+                back_shift[b & ~0x20] = j;
+        }
+    }
+}
+
+// A set of bytes the candidate filter can test with one compare: a single
+// byte, or two that differ only in bit 0x20
+static bool filter_for(const std::bitset<256>& set, unsigned char* byte, unsigned char* or_mask)
+{
+    int first = -1, second = -1;
+    for (int b = 0; b < 256; b++) {
+        if (!set[b])
+            continue;
+        if (first < 0)
+            first = b;
+        else if (second < 0)
+            second = b;
+        else
+            return false;
+    }
+    if (second < 0) {
+        *byte = first;
+        *or_mask = 0;
+        return true;
+    }
+    if ((first ^ second) != 0x20)
+        return false;
+    *byte = second;
+    *or_mask = 0x20;
+    return true;
+}
+
+// Fold the pattern a character at a time. All characters that fold alike
+// have the same UTF-8 length, so every offset of a match holds a byte of
+// one of the forms of the same character; the filter looks at the first
+// and the last offset where those forms leave it something simple to test.
+void TextSearch::setup_fold()
+{
+    size_t len = pattern.size();
+    const unsigned char* s = (const unsigned char*)&pattern[0];
+    std::vector<std::bitset<256> > allowed(len);
+    for (size_t i = 0; i < len; ) {
+        size_t n = s[i] >= 0xF0 ? 4 : s[i] >= 0xE0 ? 3 : s[i] >= 0xC0 ? 2 : 1;
+        unsigned int c = n <= len - i ? utf8_decode(s + i, n) : (unsigned int)-1;
+        if (n == 1 || c == (unsigned int)-1 || c < 0x80) {
+            n = 1;
+            c = s[i] < 0x80 ? s[i] : FOLD_RAW_BYTE + s[i];
+        }
+        folded.push_back(case_fold(c));
+        widths.push_back(n);
+
+        unsigned int forms[8];
+        size_t k = c < FOLD_RAW_BYTE ? std::min(case_fold_variants(c, forms, 8), (size_t)8) : 0;
+        unsigned char bytes[4];
+        if (k == 0) {
+            forms[0] = FOLD_RAW_BYTE;
+            k = 1;
+        }
+        for (size_t v = 0; v < k; v++) {
+            if (forms[v] == FOLD_RAW_BYTE)
+                bytes[0] = s[i];
+            else
+                utf8_encode(forms[v], bytes);
+            for (size_t j = 0; j < n; j++) {
+                allowed[i + j].set(bytes[j]);
+                if (i + j > 0)
+                    back_shift[bytes[j]] = std::min(back_shift[bytes[j]], i + j);
+            }
+        }
+        i += n;
+    }
+
+    bool any = false;
+    for (size_t j = 0; j < len; j++) {
+        unsigned char byte, or_mask;
+        if (!filter_for(allowed[j], &byte, &or_mask))
+            continue;
+        if (!any) {
+            first_at = j;
+            first_byte = byte;
+            first_or = or_mask;
+            any = true;
+        }
+        last_at = j;
+        last_byte = byte;
+        last_or = or_mask;
+    }
+    if (!any) {
+        first_at = last_at = 0;
+        first_byte = first_or = last_byte = last_or = 0xFF;
+    }
+}
+
+// Compare character by character, folding the text's as it goes
+bool TextSearch::verify_folded(const char* p) const
+{
+    const unsigned char* s = (const unsigned char*)p;
+    for (size_t i = 0; i < folded.size(); i++) {
+        size_t n = widths[i];
+        unsigned int c;
+        if (n == 1)
+            c = *s < 0x80 ? ascii_lower(*s) : FOLD_RAW_BYTE + *s;
+        else
+            c = case_fold(utf8_decode(s, n));
+        if (c != folded[i])
+            return false;
+        s += n;
+    }
+    return true;
+}
+
+// Compare the bytes between the first and the last, which the filter has
+// already matched.
+bool TextSearch::verify(const char* p) const
+{
+    if (fold_unicode)
+        return verify_folded(p);
+    size_t len = pattern.size();
+    if (len <= 2)
+        return true;
+    if (match_case)
+        return memcmp(p + 1, &pattern[1], len - 2) == 0;
+    for (size_t i = 1; i < len - 1; i++) {
+        if (ascii_lower(p[i]) != (unsigned char)pattern[i])
+            return false;
+    }
+    return true;
+}
+
+const char* TextSearch::find_scalar(const char* text, size_t len) const
+{
+    size_t plen = pattern.size();
+    if (len < plen)
+        return NULL;
+    const char* end = text + len - plen + 1;
+    for (const char* p = text; p < end; p++) {
+        if (first_or == 0) {
+            // glibc's memchr is vectorized already
+            p = (const char*)memchr(p + first_at, first_byte, end - p);
+            if (!p)
+                return NULL;
+            p -= first_at;
+        } else if (((unsigned char)p[first_at] | first_or) != first_byte) {
+            continue;
+        }
+        if (((unsigned char)p[last_at] | last_or) == last_byte && verify(p))
+            return p;
+    }
+    return NULL;
+}
+
+// Last match in text[0, len). A Horspool search run backwards: each window
+// is compared, then moved left far enough to line the byte at its start up
+// with the nearest byte of the pattern (past the first) that can equal it.
+// Matching whole bytes, a UTF-8 pattern can only ever match whole
+// characters.
+const char* TextSearch::rfind_scalar(const char* text, size_t len) const
+{
+    size_t plen = pattern.size();
+    if (len < plen)
+        return NULL;
+    size_t i = len - plen;
+    for (;;) {
+        const char* p = text + i;
+        if (((unsigned char)p[first_at] | first_or) == first_byte &&
+            ((unsigned char)p[last_at] | last_or) == last_byte && verify(p))
+            return p;
+        size_t shift = back_shift[(unsigned char)*p];
+        if (i < shift)
+            return NULL;
+        i -= shift;
+    }
+}
+
+#ifdef TEXT_SEARCH_SIMD
+
+const char* TextSearch::find_sse2(const char* text, size_t len) const
+{
+    size_t tail = pattern.size() - 1;
+    const __m128i f = _mm_set1_epi8(first_byte), f_or = _mm_set1_epi8(first_or);
+    const __m128i l = _mm_set1_epi8(last_byte), l_or = _mm_set1_epi8(last_or);
+    size_t i = 0;
+    for (; i + tail + 16 <= len; i += 16) {
+        __m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i*)(text + i + first_at)), f_or);
+        __m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i*)(text + i + last_at)), l_or);
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, f), _mm_cmpeq_epi8(b, l)));
+        while (mask) {
+            const char* p = text + i + __builtin_ctz(mask);
+            if (verify(p))
+                return p;
+            mask &= mask - 1;
+        }
+    }
+    return find_scalar(text + i, len - i);
+}
+
+__attribute__((target("avx2")))
+const char* TextSearch::find_avx2(const char* text, size_t len) const
+{
+    size_t tail = pattern.size() - 1;
+    const __m256i f = _mm256_set1_epi8(first_byte), f_or = _mm256_set1_epi8(first_or);
+    const __m256i l = _mm256_set1_epi8(last_byte), l_or = _mm256_set1_epi8(last_or);
+    size_t i = 0;
+    for (; i + tail + 32 <= len; i += 32) {
+        __m256i a = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(text + i + first_at)), f_or);
+        __m256i b = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(text + i + last_at)), l_or);
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, f), _mm256_cmpeq_epi8(b, l)));
+        while (mask) {
+            const char* p = text + i + __builtin_ctz(mask);
+            if (verify(p))
+                return p;
+            mask &= mask - 1;
+        }
+    }
+    return find_sse2(text + i, len - i);
+}
+
+// The same filters, run from the end of the text back. Where SIMD is
+// available it beats skipping ahead a few bytes at a time for any pattern
+// length; Horspool takes the head of the text too short for a vector.
+const char* TextSearch::rfind_sse2(const char* text, size_t len) const
+{
+    size_t tail = pattern.size() - 1;
+    const __m128i f = _mm_set1_epi8(first_byte), f_or = _mm_set1_epi8(first_or);
+    const __m128i l = _mm_set1_epi8(last_byte), l_or = _mm_set1_epi8(last_or);
+    size_t i = len - tail;   // candidates left start before i
+    while (i >= 16) {
+        i -= 16;
+        __m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i*)(text + i + first_at)), f_or);
+        __m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i*)(text + i + last_at)), l_or);
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, f), _mm_cmpeq_epi8(b, l)));
+        while (mask) {
+            int bit = 31 - __builtin_clz(mask);
+            const char* p = text + i + bit;
+            if (verify(p))
+                return p;
+            mask &= ~(1u << bit);
+        }
+    }
+    return rfind_scalar(text, i + tail);
+}
+
+__attribute__((target("avx2")))
+const char* TextSearch::rfind_avx2(const char* text, size_t len) const
+{
+    size_t tail = pattern.size() - 1;
+    const __m256i f = _mm256_set1_epi8(first_byte), f_or = _mm256_set1_epi8(first_or);
+    const __m256i l = _mm256_set1_epi8(last_byte), l_or = _mm256_set1_epi8(last_or);
+    size_t i = len - tail;
+    while (i >= 32) {
+        i -= 32;
+        __m256i a = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(text + i + first_at)), f_or);
+        __m256i b = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(text + i + last_at)), l_or);
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, f), _mm256_cmpeq_epi8(b, l)));
+        while (mask) {
+            int bit = 31 - __builtin_clz(mask);
+            const char* p = text + i + bit;
+            if (verify(p))
+                return p;
+            mask &= ~(1u << bit);
+        }
+    }
+    return rfind_sse2(text, i + tail);
+}
+
+#endif // TEXT_SEARCH_SIMD
+
+const char* TextSearch::find(const char* text, size_t len) const
+{
+    if (pattern.empty() || len < pattern.size())
+        return NULL;
+#ifdef TEXT_SEARCH_SIMD
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2)
+        return find_avx2(text, len);
+    return find_sse2(text, len);
+#else
+    return find_scalar(text, len);
+#endif
+}
+
+const char* TextSearch::rfind(const char* text, size_t len) const
+{
+    if (pattern.empty() || len < pattern.size())
+        return NULL;
+#ifdef TEXT_SEARCH_SIMD
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2)
+        return rfind_avx2(text, len);
+    return rfind_sse2(text, len);
+#else
+    return rfind_scalar(text, len);
+#endif
+}
+
+// State of a scan over consecutive segments. The last length() - 1 bytes of
+// each segment are carried over, so that matches across a boundary are
+// found by searching the carry joined to the head of the next segment.
+struct SegmentScan {
+    const TextSearch* search;
+    size_t offset;            // document offset of the next segment
+    size_t next;              // earliest start allowed for the next match
+    size_t limit;             // matches must start before this
+    std::vector<char> carry;  // up to length() - 1 bytes before offset
+    bool (*found)(size_t match, void* arg);   // false stops the scan
+    void* arg;
+};
+
+static bool scan_segment(const char* data, size_t len, void* arg)
+{
+    SegmentScan* s = (SegmentScan*)arg;
+    size_t plen = s->search->length();
+    size_t keep = plen - 1;
+
+    // Matches that start in the carried bytes and end in this segment
+    if (!s->carry.empty()) {
+        size_t carried = s->carry.size();
+        size_t base = s->offset - carried;
+        s->carry.insert(s->carry.end(), data, data + (len < keep ? len : keep));
+        const char* joined = &s->carry[0];
+        size_t i = s->next > base ? s->next - base : 0;
+        while (i < carried) {
+            const char* p = s->search->find(joined + i, s->carry.size() - i);
+            if (!p || (size_t)(p - joined) >= carried)
+                break;
+            size_t match = base + (p - joined);
+            if (match >= s->limit || !s->found(match, s->arg))
+                return false;
+            s->next = match + plen;
+            i = p - joined + plen;
+        }
+        s->carry.resize(carried);
+    }
+
+    size_t i = s->next > s->offset ? s->next - s->offset : 0;
+    while (i < len) {
+        const char* p = s->search->find(data + i, len - i);
+        if (!p)
+            break;
+        size_t match = s->offset + (p - data);
+        if (match >= s->limit || !s->found(match, s->arg))
+            return false;
+        s->next = match + plen;
+        i = p - data + plen;
+    }
+
+    if (len >= keep) {
+        s->carry.assign(data + len - keep, data + len);
+    } else {
+        s->carry.insert(s->carry.end(), data, data + len);
+        if (s->carry.size() > keep)
+            s->carry.erase(s->carry.begin(), s->carry.end() - keep);
+    }
+    s->offset += len;
+    // done once every byte a match starting before limit needs was seen
+    return s->offset < s->limit || s->offset - s->limit < keep;
+}
+
+static void scan_init(SegmentScan* s, const TextSearch* search, size_t from, size_t limit,
+                      bool (*found)(size_t, void*), void* arg)
+{
+    s->search = search;
+    s->offset = from;
+    s->next = from;
+    s->limit = limit;
+    s->found = found;
+    s->arg = arg;
+    s->carry.reserve(2 * search->length());
+}
+
+static bool found_first(size_t match, void* arg)
+{
+    *(size_t*)arg = match;
+    return false;
+}
+
+bool TextSearch::find_forward(const PieceTable* pieces, size_t from, size_t to, size_t* match) const
+{
+    if (to > pieces->length())
+        to = pieces->length();
+    if (pattern.empty() || from >= to || to - from < pattern.size())
+        return false;
+
+    size_t first = (size_t)-1;
+    SegmentScan s;
+    scan_init(&s, this, from, (size_t)-1, found_first, &first);
+    pieces->for_each_segment(from, to - from, scan_segment, &s);
+    if (first == (size_t)-1)
+        return false;
+    *match = first;
+    return true;
+}
+
+bool TextSearch::find_backward(const PieceTable* pieces, size_t from, size_t to, size_t* match) const
+{
+    size_t plen = pattern.size();
+    if (to > pieces->length())
+        to = pieces->length();
+    if (plen == 0 || from >= to || to - from < plen)
+        return false;
+
+    // Blocks copied out from the end backwards, each overlapping the one
+    // after it by plen - 1 bytes so that no match is missed between them
+    std::vector<char> block;
+    size_t end = to;
+    for (;;) {
+        size_t start = end - from > TEXT_SEARCH_BACK_BLOCK + plen - 1
+                       ? end - TEXT_SEARCH_BACK_BLOCK - (plen - 1) : from;
+        block.resize(end - start);
+        pieces->copy(start, end - start, &block[0]);
+        const char* p = rfind(&block[0], end - start);
+        if (p) {
+            *match = start + (p - &block[0]);
+            return true;
+        }
+        if (start == from)
+            return false;
+        end = start + plen - 1;
+    }
+}
+
+static bool found_append(size_t match, void* arg)
+{
+    ((std::vector<size_t>*)arg)->push_back(match);
+    return true;
+}
+
+void TextSearch::find_all(const TextSpan* spans, const size_t* starts, size_t n,
+                          size_t from, size_t to, std::vector<size_t>* out) const
+{
+    if (pattern.empty() || n == 0 || from >= to)
+        return;
+
+    // first span holding from
+    size_t lo = 0, hi = n;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (starts[mid] <= from)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    SegmentScan s;
+    scan_init(&s, this, from, to, found_append, out);
+    size_t skip = from - starts[lo];
+    for (size_t k = lo; k < n; k++) {
+        if (skip >= spans[k].len) {
+            skip -= spans[k].len;
+            continue;
+        }
+        if (!scan_segment(spans[k].data + skip, spans[k].len - skip, &s))
+            break;
+        skip = 0;
+    }
+}
+
+static bool snapshot_segment(const char* data, size_t len, void* arg)
+{
+    TextSnapshot* snap = (TextSnapshot*)arg;
+    TextSpan span = { data, len };
+    snap->starts.push_back(snap->length);
+    snap->spans.push_back(span);
+    snap->length += len;
+    return true;
+}
+
+void text_snapshot(const PieceTable* pieces, TextSnapshot* snap)
+{
+    snap->spans.clear();
+    snap->starts.clear();
+    snap->length = 0;
+    pieces->for_each_segment(0, pieces->length(), snapshot_segment, snap);
+}
+
+struct ChunkSearch {
+    const TextSearch* search;
+    const TextSnapshot* snap;
+    std::vector<std::vector<size_t> > results;   // by chunk number
+    std::atomic<size_t> next;
+};
+
+static void search_chunks(ChunkSearch* cs)
+{
+    const TextSnapshot* snap = cs->snap;
+    for (;;) {
+        size_t c = cs->next++;
+        if (c >= cs->results.size())
+            break;
+        size_t from = c * TEXT_SEARCH_CHUNK;
+        size_t to = std::min(from + TEXT_SEARCH_CHUNK, snap->length);
+        cs->search->find_all(&snap->spans[0], &snap->starts[0], snap->spans.size(),
+                             from, to, &cs->results[c]);
+    }
+}
+
+void TextSearch::find_all(const PieceTable* pieces, std::vector<size_t>* out) const
+{
+    size_t plen = pattern.size();
+    if (plen == 0 || pieces->length() < plen)
+        return;
+
+    // The piece table isn't safe to walk from several threads, its spans are
+    TextSnapshot snap;
+    text_snapshot(pieces, &snap);
+
+    size_t n = (snap.length + TEXT_SEARCH_CHUNK - 1) / TEXT_SEARCH_CHUNK;
+    size_t threads = std::thread::hardware_concurrency();
+    threads = std::min(std::min(threads, (size_t)TEXT_SEARCH_MAX_THREADS), n);
+    if (threads <= 1) {
+        find_all(&snap.spans[0], &snap.starts[0], snap.spans.size(), 0, snap.length, out);
+        return;
+    }
+
+    ChunkSearch cs;
+    cs.search = this;
+    cs.snap = &snap;
+    cs.results.resize(n);
+    cs.next = 0;
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; i++)
+        workers.push_back(std::thread(search_chunks, &cs));
+    search_chunks(&cs);
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    // Each chunk was searched from its own start. Where its first match
+    // overlaps the last one taken (only possible for a pattern that can
+    // overlap itself), the chunk is searched again from the end of that
+    // match; otherwise its matches are the ones a single search finds.
+    size_t q = 0;
+    for (size_t c = 0; c < n; c++) {
+        std::vector<size_t>& r = cs.results[c];
+        if (!r.empty() && r[0] < q) {
+            r.clear();
+            size_t to = std::min((c + 1) * TEXT_SEARCH_CHUNK, snap.length);
+            find_all(&snap.spans[0], &snap.starts[0], snap.spans.size(), q, to, &r);
+        }
+        if (r.empty())
+            continue;
+        out->insert(out->end(), r.begin(), r.end());
+        q = r.back() + plen;
+    }
+}
@@ -0,0 +1,87 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#ifndef TEXT_SEARCH_H
+#define TEXT_SEARCH_H
+
+#include <stddef.h>
+#include <vector>
+#include "piece_table.h"
+
+// The layout of a document as a list of spans, span k starting at offset
+// starts[k]. Searches that run long or on other threads work on one of
+// these rather than walking the piece table.
+struct TextSnapshot {
+    std::vector<TextSpan> spans;
+    std::vector<size_t> starts;
+    size_t length;
+};
+
+void text_snapshot(const PieceTable* pieces, TextSnapshot* snap);
+
+// Literal search over raw document bytes. Candidates are picked out 16 or 32
+// bytes at a time by comparing two bytes of the pattern, normally its first
+// and last, with SSE2 or AVX2, and only those are compared in full; the
+// scan itself allocates nothing. Searching backwards runs the same filter
+// from the end, falling back to a reverse Horspool search. Without
+// match_case, letters match either case: ASCII ones by a bit mask, others
+// by folding each character through case_fold() as it is compared.
+class TextSearch {
+public:
+    TextSearch(const char* pattern, size_t len, bool match_case);
+
+    size_t length() const { return pattern.size(); }
+
+    // First match in text[0, len), or NULL
+    const char* find(const char* text, size_t len) const;
+    // Last match in text[0, len), or NULL
+    const char* rfind(const char* text, size_t len) const;
+    // First match lying wholly within [from, to) of the document, including
+    // matches that span two pieces.
+    bool find_forward(const PieceTable* pieces, size_t from, size_t to, size_t* match) const;
+    // Last match lying wholly within [from, to) of the document
+    bool find_backward(const PieceTable* pieces, size_t from, size_t to, size_t* match) const;
+    // Append to out, in order, every match starting in [from, to) of a text
+    // laid out as n consecutive spans, span k starting at document offset
+    // starts[k]. Matches don't overlap; the bytes after "to" are read only
+    // to complete a match. Reads nothing but the span bytes, so it may run
+    // on another thread against a snapshot of the pieces.
+    void find_all(const TextSpan* spans, const size_t* starts, size_t n,
+                  size_t from, size_t to, std::vector<size_t>* out) const;
+    // Every match in the document, in order and without overlaps, as one
+    // search from the start would find them. Large documents are split into
+    // chunks searched by several threads at once.
+    void find_all(const PieceTable* pieces, std::vector<size_t>* out) const;
+
+private:
+    std::vector<char> pattern;   // ASCII lower-cased unless match_case
+    bool match_case;
+    // Candidate filter: (p[*_at] | *_or) == *_byte. The or-mask is 0x20 for
+    // a letter under !match_case, which folds 'A' onto 'a' and nothing else;
+    // 0xFF lets every byte through.
+    size_t first_at, last_at;
+    unsigned char first_byte, first_or;
+    unsigned char last_byte, last_or;
+    // Without match_case, for a pattern that isn't all ASCII: its
+    // characters folded, and their lengths in bytes
+    bool fold_unicode;
+    std::vector<unsigned int> folded;
+    std::vector<unsigned char> widths;
+    // For rfind(): how far left to move a window starting with each byte
+    std::vector<size_t> back_shift;
+
+    void setup_fold();
+    bool verify(const char* p) const;
+    bool verify_folded(const char* p) const;
+    const char* find_scalar(const char* text, size_t len) const;
+    const char* rfind_scalar(const char* text, size_t len) const;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+    const char* find_sse2(const char* text, size_t len) const;
+    const char* find_avx2(const char* text, size_t len) const;
+    const char* rfind_sse2(const char* text, size_t len) const;
+    const char* rfind_avx2(const char* text, size_t len) const;
+#endif
+};
+
+#endif // TEXT_SEARCH_H
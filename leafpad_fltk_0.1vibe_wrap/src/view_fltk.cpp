@@ -4,14 +4,40 @@
 
 #include "view_fltk.h"
 #include "window_fltk.h"
+#include "file_fltk.h"
+#include "highlight_fltk.h"
 #include <FL/Fl.H>
 
+// Keys that only move the cursor or the view; everything else may edit
+static bool is_navigation_key(int key) {
+    switch (key) {
+    case FL_Home: case FL_End: case FL_Page_Up: case FL_Page_Down:
+    case FL_Left: case FL_Right: case FL_Up: case FL_Down:
+        return true;
+    }
+    return false;
+}
+
 EditorView::EditorView(int x, int y, int w, int h, MainWindow* win, const char* label) : Fl_Text_Editor(x, y, w, h, label) {
     last_key = 0;
     main_win = win;
 }
 
 int EditorView::handle(int event) {
+    if (file_open_in_progress(main_win)) {
+        // The buffer is still being filled at its end: allow looking around
+        // but not editing, and let Escape abort the load.
+        if (event == FL_KEYBOARD) {
+            if (Fl::event_key() == FL_Escape) {
+                file_open_cancel(main_win);
+                return 1;
+            }
+            if (!is_navigation_key(Fl::event_key()))
+                return 1;
+        } else if (event == FL_PASTE) {
+            return 1;
+        }
+    }
     if (event == FL_KEYBOARD) {
         if (Fl::test_shortcut(FL_CTRL + 'z')) {
             main_win->undo_manager->undo();
@@ -23,5 +49,9 @@ int EditorView::handle(int event) {
         }
         last_key = Fl::event_key();
     }
-    return Fl_Text_Editor::handle(event);
+    int handled = Fl_Text_Editor::handle(event);
+    // The selection may have moved onto or off a match
+    if (event == FL_KEYBOARD || event == FL_RELEASE || event == FL_DRAG)
+        main_win->highlighter->selection_moved();
+    return handled;
 }
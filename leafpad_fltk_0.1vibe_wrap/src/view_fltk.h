@@ -16,6 +16,8 @@ public:
 
     EditorView(int x, int y, int w, int h, MainWindow* win, const char* label = 0);
     int handle(int event) override;
+    // Byte offsets of the first and last character on screen
+    void visible_range(int* first, int* last) const { *first = mFirstChar; *last = mLastChar; }
 };
 
 #endif // VIEW_FLTK_H
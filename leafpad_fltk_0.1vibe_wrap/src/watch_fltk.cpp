@@ -0,0 +1,287 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#include "watch_fltk.h"
+#include "window_fltk.h"
+#include "file_fltk.h"
+#include "piece_table.h"
+#include "change_tracker.h"
+#include "journal.h"
+#include <FL/Fl.H>
+#include <FL/Fl_Text_Buffer.H>
+#include <FL/Fl_Menu_Item.H>
+#include <FL/fl_ask.H>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+// Seconds from a change to the file to looking at it, so that a burst of
+// writes is taken in at once
+#define WATCH_DELAY   0.1
+// The same in follow mode: appends are read in at most once a frame
+#define FOLLOW_FRAME  (1.0 / 30)
+// Most bytes read in per frame, so a file far ahead is caught up with
+// over several frames without the UI stalling
+#define FOLLOW_FRAME_BYTES  (8 * 1024 * 1024)
+// Bytes copied out of the editor buffer at a time when the piece table
+// lets go of the file
+#define DETACH_BLOCK  (1024 * 1024)
+
+struct FileWatch {
+    MainWindow* window;
+    int fd;             // inotify instance, read from the event loop
+    int wd;             // watch on the file's directory, -1 for none
+    char* path;         // the file, symlinks resolved
+    const char* name;   // its last component, within path
+    struct stat seen;   // the file as the last look found it
+    bool scheduled;     // a look is due
+    bool asking;        // a reload prompt is up
+};
+
+static void watch_check_cb(void* data);
+
+static void watch_schedule(FileWatch* watch, double delay)
+{
+    if (watch->scheduled)
+        return;
+    Fl::add_timeout(delay, watch_check_cb, watch);
+    watch->scheduled = true;
+}
+
+static void watch_read_buffer(size_t pos, size_t len, char* out, void* arg)
+{
+    Fl_Text_Buffer* buffer = (Fl_Text_Buffer*)arg;
+    while (len > 0) {
+        size_t n = std::min(len, (size_t)DETACH_BLOCK);
+        char* text = buffer->text_range((int)pos, (int)(pos + n));
+        memcpy(out, text, n);
+        free(text);
+        pos += n;
+        out += n;
+        len -= n;
+    }
+}
+
+// The piece table reads the text it was loaded with through a private
+// mapping of the file, which faults past the file's end and elsewhere
+// shows what another program writes there. Once the file is cut short or
+// rewritten, the text is taken from the editor buffer instead, which
+// holds all of the document; what only the undo history had reads as '?'.
+static void watch_detach(MainWindow* window)
+{
+    window->pieces->detach_original('?', watch_read_buffer, window->editor->buffer());
+}
+
+// A file whose appends can't be read in as they are would have to be
+// reloaded whole on each one: say so, and stop following
+static bool follow_possible(MainWindow* window)
+{
+    if (!window->current_filename || file_appendable(window))
+        return true;
+    window->follow = false;
+    if (window->follow_item)
+        window->follow_item->clear();
+    fl_alert("'%s' can't be followed:\nonly UTF-8 files with LF line breaks can.",
+             window->current_filename);
+    return false;
+}
+
+static void follow_show_end(MainWindow* window)
+{
+    window->editor->insert_position(window->editor->buffer()->length());
+    window->editor->show_insert_position();
+}
+
+// Drop the start of a followed document that grew past the cap, down to a
+// line start a quarter of the cap below it so that this happens seldom:
+// each time the whole buffer moves. The history goes with it, as its
+// positions no longer hold, and the journal, as the document is no
+// longer the file. Not while there are unsaved edits, which would then be
+// neither undoable nor recoverable.
+static void follow_trim(MainWindow* window)
+{
+    Fl_Text_Buffer* buffer = window->editor->buffer();
+    size_t len = (size_t)buffer->length();
+    if (!window->follow_cap || len <= window->follow_cap
+        || !window->changes->ranges().empty() || window->changed)
+        return;
+    size_t drop = len - window->follow_cap / 4 * 3;
+    PieceTable* pieces = window->pieces;
+    size_t next_line = pieces->line_start(pieces->byte_to_line(drop - 1) + 1);
+    if (next_line < len)
+        drop = next_line;
+
+    window->undo_manager->begin_external();
+    buffer->remove(0, (int)drop);
+    window->undo_manager->end_external();
+    window->undo_manager->clear_all();
+    pieces->release_unused(std::vector<TextSpan>());
+    window->follow_dropped += drop;
+    window->changes->reset(pieces->length());
+    window->journal->start(NULL, NULL);
+}
+
+static void watch_check_cb(void* data)
+{
+    FileWatch* watch = (FileWatch*)data;
+    MainWindow* window = watch->window;
+    watch->scheduled = false;
+    // A load sets up the watch afresh once it's done
+    if (watch->asking || !watch->path || file_open_in_progress(window))
+        return;
+
+    // Gone for now: a file replaced by a rename is back soon enough
+    struct stat st;
+    if (stat(watch->path, &st) < 0 || file_stat_same(&st, &watch->seen))
+        return;
+    watch->seen = st;
+    // Our own save, or growth read in already
+    if (file_stat_same(&st, &window->file_stat))
+        return;
+    off_t had = window->file_stat.st_size;
+    if (file_append_tail(window, window->follow ? FOLLOW_FRAME_BYTES : (size_t)-1)) {
+        if (window->follow) {
+            follow_trim(window);
+            follow_show_end(window);
+            // Still behind: carry on next frame
+            if (window->file_stat.st_size > had && window->file_stat.st_size < st.st_size) {
+                memset(&watch->seen, 0, sizeof(watch->seen));
+                watch_schedule(watch, FOLLOW_FRAME);
+            }
+        }
+        return;
+    }
+    // Not an append: if the file was changed where it is, the text read
+    // from it is gone
+    if (st.st_dev == window->file_stat.st_dev && st.st_ino == window->file_stat.st_ino)
+        watch_detach(window);
+
+    // A followed log that was rotated or truncated is simply read again,
+    // unless there are edits to lose
+    int reload = 1;
+    bool untouched = window->changes->ranges().empty() && !window->changed;
+    bool rotated = st.st_dev != window->file_stat.st_dev || st.st_ino != window->file_stat.st_ino
+        || st.st_size < window->file_stat.st_size;
+    watch->asking = true;
+    if (!window->follow || !untouched || !rotated) {
+        reload = fl_choice(window->changed
+            ? "'%s' was changed by another program.\nReload it and lose your changes?"
+            : "'%s' was changed by another program.\nReload it?",
+            "Keep", "Reload", NULL, window->current_filename);
+    }
+    watch->asking = false;
+    if (reload == 1 && window->current_filename) {
+        char* filename = strdup(window->current_filename);
+        file_open_real(window, filename);
+        free(filename);
+    }
+}
+
+// Events for anything in the directory: only those naming the file count
+static void watch_fd_cb(int fd, void* data)
+{
+    FileWatch* watch = (FileWatch*)data;
+    char events[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool hit = false;
+    ssize_t n;
+    while ((n = read(fd, events, sizeof(events))) > 0) {
+        for (char* p = events; p < events + n; ) {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            if (ev->len && watch->name && strcmp(ev->name, watch->name) == 0)
+                hit = true;
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    if (!hit)
+        return;
+    // A file cut short faults on the next read past its end: no waiting
+    MainWindow* window = watch->window;
+    struct stat st;
+    if (!file_open_in_progress(window) && stat(watch->path, &st) == 0
+        && st.st_dev == window->file_stat.st_dev && st.st_ino == window->file_stat.st_ino
+        && st.st_size < window->file_stat.st_size)
+        watch_detach(window);
+    watch_schedule(watch, window->follow ? FOLLOW_FRAME : WATCH_DELAY);
+}
+
+void file_watch(MainWindow* window, const char* filename)
+{
+    FileWatch* watch = window->watch;
+    if (!watch) {
+        if (!filename)
+            return;
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0)
+            return;
+        watch = (FileWatch*)calloc(1, sizeof(FileWatch));
+        watch->window = window;
+        watch->fd = fd;
+        watch->wd = -1;
+        Fl::add_fd(fd, FL_READ, watch_fd_cb, watch);
+        window->watch = watch;
+    }
+
+    if (watch->wd >= 0)
+        inotify_rm_watch(watch->fd, watch->wd);
+    watch->wd = -1;
+    free(watch->path);
+    watch->path = NULL;
+    watch->name = NULL;
+    if (watch->scheduled)
+        Fl::remove_timeout(watch_check_cb, watch);
+    watch->scheduled = false;
+    if (!filename)
+        return;
+
+    char* path = realpath(filename, NULL);
+    watch->path = path ? path : strdup(filename);
+    char* slash = strrchr(watch->path, '/');
+    watch->name = slash ? slash + 1 : watch->path;
+    char* dir = slash ? strndup(watch->path, slash - watch->path + 1) : strdup(".");
+    watch->wd = inotify_add_watch(watch->fd, dir,
+                                  IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE
+                                  | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+    free(dir);
+    watch->seen = window->file_stat;
+    if (window->follow && follow_possible(window)) {
+        follow_show_end(window);
+        memset(&watch->seen, 0, sizeof(watch->seen));
+        watch_schedule(watch, 0.0);
+    }
+}
+
+// The inotify events that come meanwhile wait in its fd
+void file_watch_pause(MainWindow* window, bool paused)
+{
+    FileWatch* watch = window->watch;
+    if (!watch)
+        return;
+    if (paused) {
+        Fl::remove_fd(watch->fd);
+        if (watch->scheduled)
+            Fl::remove_timeout(watch_check_cb, watch);
+        watch->scheduled = false;
+    } else {
+        Fl::add_fd(watch->fd, FL_READ, watch_fd_cb, watch);
+        if (watch->path)
+            watch_schedule(watch, 0.0);
+    }
+}
+
+void file_follow(MainWindow* window, bool on)
+{
+    window->follow = on;
+    FileWatch* watch = window->watch;
+    if (!on || !follow_possible(window) || !watch || !watch->path)
+        return;
+    // Catch up with what was appended before
+    follow_show_end(window);
+    memset(&watch->seen, 0, sizeof(watch->seen));
+    watch_schedule(watch, 0.0);
+}
@@ -0,0 +1,31 @@
+/*
+ *  Leafpad - FLTK based simple text editor
+ */
+
+#ifndef WATCH_FLTK_H
+#define WATCH_FLTK_H
+
+class MainWindow;
+
+// Watch filename for changes other programs make to it, instead of the
+// file window watched before; NULL stops watching. An inotify watch on
+// the file's directory, so that a file replaced by a rename is noticed
+// too, is read from the FLTK event loop. A burst of changes is looked at
+// together a moment after it starts: growth of an untouched document is
+// appended to it, anything else offers a reload. A file cut short or
+// rewritten in place stops being read through its mapping at once.
+void file_watch(MainWindow* window, const char* filename);
+
+// Stop looking at the file, for as long as something reads the document
+// while the event loop runs, and catch up after
+void file_watch_pause(MainWindow* window, bool paused);
+
+// Follow mode, as tail -f: what is appended to the file is read in a
+// frame at a time and the view kept at the end. With window->follow_cap
+// set, the start of the document is dropped to keep it under that size.
+// Only UTF-8 files with LF line breaks can be followed, as appends to any
+// other would have to be converted; for those follow mode is refused, and
+// turned off again when such a file is opened.
+void file_follow(MainWindow* window, bool on);
+
+#endif // WATCH_FLTK_H
@@ -6,8 +6,20 @@
 #include "view_fltk.h"
 #include "callback_fltk.h"
 #include "dialog_fltk.h"
+#include "piece_table.h"
+#include "change_tracker.h"
+#include "journal.h"
+#include "highlight_fltk.h"
+#include "minimap_fltk.h"
+#include "watch_fltk.h"
 #include <FL/Fl_Menu_Bar.H>
 #include <FL/Fl_Text_Buffer.H>
+#include <FL/Fl_Box.H>
+#include <FL/Fl_Progress.H>
+#include <string.h>
+
+#define STATUS_BAR_HEIGHT 22
+#define MINIMAP_WIDTH 8
 
 // Callback for the "About" menu item
 static void on_about_cb(Fl_Widget*, void*) {
@@ -33,18 +45,52 @@ static void on_options_line_wrap(Fl_Widget* w, void* data) {
     }
 }
 
+static void on_options_follow(Fl_Widget*, void* data) {
+    MainWindow* win = (MainWindow*)data;
+    file_follow(win, !win->follow);
+    if (win->follow_item) {
+        if (win->follow) {
+            win->follow_item->set();
+        } else {
+            win->follow_item->clear();
+        }
+    }
+}
+
+// The highlighter's match index changed
+static void on_matches_changed(void* data) {
+    MainWindow* win = (MainWindow*)data;
+    win->minimap->update();
+}
 
 MainWindow::MainWindow(int w, int h, const char* title) : Fl_Window(w, h, title) {
     current_filename = NULL;
+    charset = "UTF-8";
+    line_ending = LINE_ENDING_LF;
+    loader = NULL;
+    watch = NULL;
+    follow = false;
+    follow_cap = FOLLOW_DEFAULT_CAP;
+    follow_dropped = 0;
+    history_status = NULL;
     changed = false;
     line_wrap_enabled = false;
 
     begin();
 
-    editor = new EditorView(0, 30, w, h - 30, this);
-    Fl_Text_Buffer *buff = new Fl_Text_Buffer();
+    editor = new EditorView(0, 30, w - MINIMAP_WIDTH, h - 30 - STATUS_BAR_HEIGHT, this);
+    Fl_Text_Buffer *buff = new Fl_Text_Buffer(0, DOCUMENT_GAP);
     editor->buffer(buff);
-    undo_manager = new UndoManager(buff, editor, this);
+    pieces = new PieceTable();
+    undo_manager = new UndoManager(buff, pieces, editor, this);
+    changes = new ChangeTracker();
+    undo_manager->set_change_tracker(changes);
+    journal = new EditJournal();
+    undo_manager->set_journal(journal);
+    memset(&file_stat, 0, sizeof(file_stat));
+    highlighter = new MatchHighlighter(editor, pieces);
+    minimap = new MatchMinimap(w - MINIMAP_WIDTH, 30, MINIMAP_WIDTH,
+                               h - 30 - STATUS_BAR_HEIGHT, this);
 
     Fl_Menu_Item menu_items[] = {
         { "&File", 0, 0, 0, FL_SUBMENU },
@@ -62,8 +108,16 @@ MainWindow::MainWindow(int w, int h, const char* title) : Fl_Window(w, h, title)
             { "&Paste", FL_CTRL + 'v', (Fl_Callback *)on_edit_paste, this },
             { "Select &All", FL_CTRL + 'a', (Fl_Callback *)on_edit_select_all, this },
             { 0 },
+        { "&Search", 0, 0, 0, FL_SUBMENU },
+            { "&Find...", FL_CTRL + 'f', (Fl_Callback *)on_search_find, this },
+            { "Find &Next", FL_CTRL + 'g', (Fl_Callback *)on_search_find_next, this },
+            { "Find &Previous", FL_CTRL + FL_SHIFT + 'g', (Fl_Callback *)on_search_find_previous, this },
+            { "&Replace...", FL_CTRL + 'h', (Fl_Callback *)on_search_replace, this, FL_MENU_DIVIDER },
+            { "&Jump To...", FL_CTRL + 'j', (Fl_Callback *)on_search_jump_to, this },
+            { 0 },
         { "&Options", 0, 0, 0, FL_SUBMENU },
             { "&Line Wrap", 0, (Fl_Callback *)on_options_line_wrap, this, FL_MENU_TOGGLE },
+            { "&Follow File", FL_CTRL + 'l', (Fl_Callback *)on_options_follow, this, FL_MENU_TOGGLE },
             { 0 },
         { "&Help", 0, 0, 0, FL_SUBMENU },
             { "&About", 0, (Fl_Callback*)on_about_cb },
@@ -73,7 +127,32 @@ MainWindow::MainWindow(int w, int h, const char* title) : Fl_Window(w, h, title)
 
     Fl_Menu_Bar* menu = new Fl_Menu_Bar(0, 0, w, 30);
     menu->copy(menu_items);
+    follow_item = (Fl_Menu_Item*)menu->find_item("&Options/&Follow File");
+
+    status_bar = new Fl_Box(0, h - STATUS_BAR_HEIGHT, w - 350, STATUS_BAR_HEIGHT);
+    status_bar->box(FL_THIN_DOWN_BOX);
+    status_bar->align(FL_ALIGN_LEFT | FL_ALIGN_INSIDE | FL_ALIGN_CLIP);
+    status_bar->labelsize(12);
+
+    match_status = new Fl_Box(w - 350, h - STATUS_BAR_HEIGHT, 150, STATUS_BAR_HEIGHT);
+    match_status->box(FL_THIN_DOWN_BOX);
+    match_status->align(FL_ALIGN_LEFT | FL_ALIGN_INSIDE | FL_ALIGN_CLIP);
+    match_status->labelsize(11);
+
+    history_status = new Fl_Box(w - 200, h - STATUS_BAR_HEIGHT, 200, STATUS_BAR_HEIGHT);
+    history_status->box(FL_THIN_DOWN_BOX);
+    history_status->align(FL_ALIGN_RIGHT | FL_ALIGN_INSIDE | FL_ALIGN_CLIP);
+    history_status->labelsize(11);
+
+    progress = new Fl_Progress(w - 200, h - STATUS_BAR_HEIGHT, 200, STATUS_BAR_HEIGHT);
+    progress->minimum(0);
+    progress->maximum(100);
+    progress->selection_color(FL_SELECTION_COLOR);
+    progress->labelsize(11);
+    progress->hide();
 
     end();
     resizable(editor);
+    highlighter->set_status_box(match_status);
+    highlighter->set_changed_callback(on_matches_changed, this);
 }
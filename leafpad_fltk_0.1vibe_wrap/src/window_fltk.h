@@ -6,16 +6,52 @@
 #define WINDOW_FLTK_H
 
 #include <FL/Fl_Window.H>
+#include <sys/stat.h>
 #include "view_fltk.h"
 #include "UndoManager.h"
+#include "line_ending.h"
+
+// Gap the document's Fl_Text_Buffer keeps free. An insert bigger than the
+// gap copies the whole buffer into a new one, so it is made big enough
+// that appending a growing file a chunk at a time seldom has to.
+#define DOCUMENT_GAP  (16 * 1024 * 1024)
+// Bytes of a followed file kept by default
+#define FOLLOW_DEFAULT_CAP  ((size_t)64 * 1024 * 1024)
 
 struct Fl_Menu_Item;
+class Fl_Box;
+class Fl_Progress;
+struct FileLoader;
+struct FileWatch;
+class PieceTable;
+class MatchHighlighter;
+class MatchMinimap;
+class ChangeTracker;
+class EditJournal;
 
 class MainWindow : public Fl_Window {
 public:
     EditorView* editor;
     char* current_filename;
+    const char* charset;   // what the open file was detected to be in
+    LineEnding line_ending; // and how it ended its lines
     UndoManager* undo_manager;
+    MatchHighlighter* highlighter;
+    MatchMinimap* minimap;  // where the highlighted matches are
+    PieceTable* pieces;    // document text; the editor buffer mirrors it
+    ChangeTracker* changes; // how the text differs from current_filename
+    struct stat file_stat;  // that file as last read or written; st_ino 0 if none
+    EditJournal* journal;   // the edits since then, for crash recovery
+    Fl_Box* status_bar;
+    Fl_Box* match_status;   // "Match k of N"
+    Fl_Progress* progress;
+    Fl_Box* history_status; // undo memory use; shares its slot with progress
+    FileLoader* loader;    // non-NULL while a file is streaming in
+    FileWatch* watch;      // notices other programs changing the file
+    bool follow;           // keep reading what is appended, view pinned to the end
+    Fl_Menu_Item* follow_item; // its check mark in the Options menu
+    size_t follow_cap;     // bytes kept while following, 0 for no limit
+    size_t follow_dropped; // bytes of the file's start dropped to keep to it
     bool changed;
     bool line_wrap_enabled;
 